@@ -71,6 +71,9 @@ static android::status_t Mount(int device_fd, const std::string& path) {
     return android::OK;
 }
 
+// Runs directly in vold's own mount namespace: apps only ever reach AppFuse
+// files through fds opened here by OpenAppFuseFile(), so there is no app
+// namespace to enter and no process to fork per request.
 static android::status_t RunCommand(const std::string& command, uid_t uid, const std::string& path,
                                     int device_fd) {
     if (DEBUG_APPFUSE) {
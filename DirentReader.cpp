@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DirentReader.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace android {
+namespace vold {
+
+// Layout of the records returned by getdents64(2); not exported by every libc.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+DirentReader::DirentReader(int fd, size_t bufferSize)
+    : mFd(fd), mSize(bufferSize), mBuffer(new char[bufferSize]) {}
+
+bool DirentReader::next(Entry* entry) {
+    while (true) {
+        if (mPos >= mLen) {
+            long n = TEMP_FAILURE_RETRY(syscall(__NR_getdents64, mFd, mBuffer.get(), mSize));
+            if (n <= 0) {
+                mError = (n == 0) ? 0 : errno;
+                return false;
+            }
+            mLen = n;
+            mPos = 0;
+        }
+
+        auto* d = reinterpret_cast<linux_dirent64*>(mBuffer.get() + mPos);
+        mPos += d->d_reclen;
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+
+        entry->ino = d->d_ino;
+        entry->type = d->d_type;
+        entry->name = d->d_name;
+        return true;
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_DIRENT_READER_H
+#define ANDROID_VOLD_DIRENT_READER_H
+
+#include <android-base/macros.h>
+
+#include <sys/types.h>
+
+#include <memory>
+
+namespace android {
+namespace vold {
+
+/*
+ * Thin iterator over getdents64(2) on an already open directory fd.
+ *
+ * Unlike readdir(), which refills a 4-32 KiB buffer depending on the libc,
+ * this pulls as many entries as fit in a caller-sized buffer per syscall,
+ * which matters when walking directories with hundreds of thousands of
+ * entries. "." and ".." are skipped. The fd is not owned.
+ */
+class DirentReader {
+  public:
+    static constexpr size_t kDefaultBufferSize = 64 * 1024;
+
+    struct Entry {
+        ino64_t ino;
+        unsigned char type;  // DT_* value; may be DT_UNKNOWN
+        const char* name;
+    };
+
+    explicit DirentReader(int fd, size_t bufferSize = kDefaultBufferSize);
+
+    /* Returns false at the end of the directory or on error */
+    bool next(Entry* entry);
+
+    /* 0 at a clean end of the directory, otherwise the errno that stopped us */
+    int error() const { return mError; }
+
+  private:
+    const int mFd;
+    const size_t mSize;
+    std::unique_ptr<char[]> mBuffer;
+    size_t mPos = 0;
+    size_t mLen = 0;
+    int mError = 0;
+
+    DISALLOW_COPY_AND_ASSIGN(DirentReader);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
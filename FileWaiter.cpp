@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FileWaiter.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace std::chrono_literals;
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// How often a wait rechecks when its directory can't be watched
+static constexpr std::chrono::milliseconds kPollInterval = 10ms;
+
+static constexpr uint32_t kWatchMask = IN_CREATE | IN_MOVED_TO | IN_ATTRIB;
+
+FileWaiter* FileWaiter::sInstance = nullptr;
+
+FileWaiter* FileWaiter::Instance() {
+    static std::once_flag once;
+    std::call_once(once, [] { sInstance = new FileWaiter(); });
+    return sInstance;
+}
+
+FileWaiter::FileWaiter() : mInotifyFd(inotify_init1(IN_CLOEXEC)) {
+    if (mInotifyFd == -1) {
+        PLOG(ERROR) << "Failed to init inotify; waiting for files by polling";
+        return;
+    }
+    mThread = std::thread(&FileWaiter::run, this);
+}
+
+FileWaiter::Watch* FileWaiter::addWatch(const std::string& dir) {
+    Watch& watch = mWatches[dir];
+    watch.refs++;
+    if (watch.wd == -1 && mInotifyFd != -1) {
+        watch.wd = inotify_add_watch(mInotifyFd, dir.c_str(), kWatchMask);
+        if (watch.wd != -1) {
+            mDirs[watch.wd] = dir;
+        } else if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to watch " << dir;
+        }
+    }
+    return &watch;
+}
+
+void FileWaiter::removeWatch(const std::string& dir) {
+    auto it = mWatches.find(dir);
+    if (--it->second.refs > 0) return;
+    if (it->second.wd != -1) {
+        // The IN_IGNORED this generates finds nothing left to update
+        inotify_rm_watch(mInotifyFd, it->second.wd);
+        mDirs.erase(it->second.wd);
+    }
+    mWatches.erase(it);
+}
+
+void FileWaiter::run() {
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        ssize_t len = TEMP_FAILURE_RETRY(read(mInotifyFd, buf, sizeof(buf)));
+        if (len <= 0) {
+            PLOG(ERROR) << "Failed to read inotify events";
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mLock);
+        for (ssize_t pos = 0; pos < len;) {
+            auto event = reinterpret_cast<const struct inotify_event*>(buf + pos);
+            pos += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were dropped; have everyone look again
+                for (auto& [dir, watch] : mWatches) watch.generation++;
+                continue;
+            }
+            auto it = mDirs.find(event->wd);
+            if (it == mDirs.end()) continue;
+            Watch& watch = mWatches[it->second];
+            watch.generation++;
+            if (event->mask & IN_IGNORED) {
+                // The directory went away; waiters fall back to polling
+                watch.wd = -1;
+                mDirs.erase(it);
+            }
+        }
+        mChanged.notify_all();
+    }
+}
+
+status_t FileWaiter::waitFor(const std::string& path, std::chrono::nanoseconds timeout) {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + timeout;
+    std::string dir = android::base::Dirname(path);
+
+    std::unique_lock<std::mutex> lock(mLock);
+    // Watch first and stat after, so a node created in between still wakes us
+    Watch* watch = addWatch(dir);
+    status_t res = OK;
+    while (true) {
+        uint64_t generation = watch->generation;
+        bool watched = watch->wd != -1;
+
+        lock.unlock();
+        struct stat sb;
+        bool exists = stat(path.c_str(), &sb) == 0;
+        lock.lock();
+
+        if (exists) break;
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            res = -ETIMEDOUT;
+            break;
+        }
+        if (watched) {
+            mChanged.wait_until(lock, deadline, [&] { return watch->generation != generation; });
+        } else {
+            mChanged.wait_until(lock, std::min(deadline, now + kPollInterval));
+        }
+    }
+    removeWatch(dir);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record(path, elapsed, res != OK);
+    lock.unlock();
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    if (res == OK) {
+        LOG(INFO) << "wait for '" << path << "' took " << ms << "ms";
+    } else {
+        LOG(WARNING) << "wait for '" << path << "' timed out and took " << ms << "ms";
+    }
+    return res;
+}
+
+void FileWaiter::record(const std::string& path, std::chrono::nanoseconds elapsed,
+                        bool timedOut) {
+    std::string type = android::base::Basename(path);
+    while (!type.empty() && isdigit(type.back())) type.pop_back();
+
+    Stats& stats = mStats[type];
+    if (timedOut) {
+        stats.timeouts++;
+        return;
+    }
+    stats.count++;
+    stats.total += elapsed;
+    stats.max = std::max(stats.max, elapsed);
+}
+
+void FileWaiter::dump(int fd) {
+    std::lock_guard<std::mutex> lock(mLock);
+    dprintf(fd, "Time for device nodes to appear:\n");
+    for (const auto& [type, stats] : mStats) {
+        std::chrono::nanoseconds avg = stats.count ? stats.total / int64_t(stats.count) : 0ns;
+        dprintf(fd, "  %s: %" PRIu64 " waits, avg %.1fms, max %.1fms, %" PRIu64 " timeouts\n",
+                type.c_str(), stats.count,
+                std::chrono::duration<double, std::milli>(avg).count(),
+                std::chrono::duration<double, std::milli>(stats.max).count(), stats.timeouts);
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_FILE_WAITER_H
+#define ANDROID_VOLD_FILE_WAITER_H
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+#include <utils/Errors.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace vold {
+
+/*
+ * Waits for device nodes such as /dev/block/loop3 or /dev/block/dm-7 to be
+ * created by ueventd, without polling.
+ *
+ * One thread reads a shared inotify fd, and any number of callers can wait on
+ * it at once, each with its own deadline. A caller watches the parent
+ * directory before its first stat(), so a node created in between is never
+ * missed. Waits fall back to polling when the directory can't be watched.
+ *
+ * How long nodes took to appear is kept per device type, which is the node
+ * name without its trailing number, eg "loop" or "dm-".
+ */
+class FileWaiter {
+  public:
+    static FileWaiter* Instance();
+
+    /* OK once |path| exists, -ETIMEDOUT if it didn't within |timeout| */
+    status_t waitFor(const std::string& path, std::chrono::nanoseconds timeout);
+
+    /* Writes the time-to-appear statistics to |fd| */
+    void dump(int fd);
+
+  private:
+    struct Watch {
+        int wd = -1;
+        int refs = 0;
+        /* Bumped for every event in the directory */
+        uint64_t generation = 0;
+    };
+
+    struct Stats {
+        uint64_t count = 0;
+        uint64_t timeouts = 0;
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds max{0};
+    };
+
+    FileWaiter();
+
+    Watch* addWatch(const std::string& dir);
+    void removeWatch(const std::string& dir);
+    void record(const std::string& path, std::chrono::nanoseconds elapsed, bool timedOut);
+    void run();
+
+    android::base::unique_fd mInotifyFd;
+
+    std::mutex mLock;
+    std::condition_variable mChanged;
+    /* Keyed by directory; wd is -1 while it can't be watched */
+    std::map<std::string, Watch> mWatches;
+    std::map<int, std::string> mDirs;
+    std::map<std::string, Stats> mStats;
+
+    std::thread mThread;
+
+    static FileWaiter* sInstance;
+
+    DISALLOW_COPY_AND_ASSIGN(FileWaiter);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FsProbe.h"
+
+#include <android-base/stringprintf.h>
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace vold {
+
+// Everything but the FAT and exFAT root directories lives in the first 4 KiB:
+// the FAT/exFAT boot sector at 0, and the ext4 and f2fs superblocks at 1024.
+static constexpr size_t kProbeSize = 4096;
+static constexpr size_t kSuperblockOffset = 1024;
+
+// Reads |len| bytes at |offset|, zero filling anything past the end.
+using ReadFn = std::function<bool(uint8_t* buf, size_t len, uint64_t offset)>;
+
+static uint16_t Le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t Le32(const uint8_t* p) {
+    return Le16(p) | (uint32_t(Le16(p + 2)) << 16);
+}
+
+static bool IsPowerOfTwo(uint32_t v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+// FAT and exFAT print their 32-bit serial number as "ABCD-EF01"
+static std::string FormatSerial(const uint8_t* p) {
+    return StringPrintf("%02X%02X-%02X%02X", p[3], p[2], p[1], p[0]);
+}
+
+static std::string FormatUuid(const uint8_t* p) {
+    return StringPrintf(
+            "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x", p[0], p[1],
+            p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9], p[10], p[11], p[12], p[13], p[14],
+            p[15]);
+}
+
+// Up to |len| bytes, stopping at the first NUL
+static std::string CString(const uint8_t* p, size_t len) {
+    const char* s = reinterpret_cast<const char*>(p);
+    return std::string(s, strnlen(s, len));
+}
+
+// Up to |units| UTF-16LE code units, stopping at the first NUL; anything
+// malformed becomes U+FFFD
+static std::string Utf16ToUtf8(const uint8_t* p, size_t units) {
+    std::string out;
+    for (size_t i = 0; i < units; i++) {
+        uint32_t c = Le16(p + 2 * i);
+        if (c == 0) break;
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < units) {
+            uint32_t low = Le16(p + 2 * (i + 1));
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                i++;
+            } else {
+                c = 0xFFFD;
+            }
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = 0xFFFD;
+        }
+
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xC0 | (c >> 6));
+            out += char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += char(0xE0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        } else {
+            out += char(0xF0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3F));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+static bool ProbeExt(const uint8_t* head, FsProbeResult* result) {
+    const uint8_t* sb = head + kSuperblockOffset;
+    if (Le16(sb + 0x38) != 0xEF53) return false;
+    // s_log_block_size: 1 KiB to 64 KiB blocks
+    if (Le32(sb + 0x18) > 6) return false;
+
+    constexpr uint32_t kCompatHasJournal = 0x4;
+    constexpr uint32_t kIncompatJournalDev = 0x8;
+    // Features ext3 already understood; anything else makes it ext4
+    constexpr uint32_t kExt3Incompat = 0x2 | 0x4 | 0x10;
+    constexpr uint32_t kExt3RoCompat = 0x1 | 0x2 | 0x4;
+
+    uint32_t compat = Le32(sb + 0x5C);
+    uint32_t incompat = Le32(sb + 0x60);
+    uint32_t roCompat = Le32(sb + 0x64);
+    // An external journal, not a filesystem
+    if (incompat & kIncompatJournalDev) return false;
+
+    if ((incompat & ~kExt3Incompat) || (roCompat & ~kExt3RoCompat)) {
+        result->type = "ext4";
+    } else if (compat & kCompatHasJournal) {
+        result->type = "ext3";
+    } else {
+        result->type = "ext2";
+    }
+    result->uuid = FormatUuid(sb + 0x68);
+    result->label = CString(sb + 0x78, 16);
+    return true;
+}
+
+static bool ProbeF2fs(const uint8_t* head, FsProbeResult* result) {
+    const uint8_t* sb = head + kSuperblockOffset;
+    if (Le32(sb) != 0xF2F52010) return false;
+    uint32_t logSectorSize = Le32(sb + 8);
+    if (logSectorSize < 9 || logSectorSize > 12 || Le32(sb + 16) != 12) return false;
+
+    // uuid[16] follows the block addresses; volume_name is 512 UTF-16 units
+    result->type = "f2fs";
+    result->uuid = FormatUuid(sb + 108);
+    result->label = Utf16ToUtf8(sb + 124, 512);
+    return true;
+}
+
+static bool ProbeExfat(const uint8_t* head, const ReadFn& read, FsProbeResult* result) {
+    if (memcmp(head + 3, "EXFAT   ", 8) != 0) return false;
+    for (size_t i = 11; i < 64; i++) {
+        if (head[i] != 0) return false;
+    }
+    uint32_t bytesPerSectorShift = head[108];
+    uint32_t sectorsPerClusterShift = head[109];
+    if (bytesPerSectorShift < 9 || bytesPerSectorShift > 12) return false;
+    if (sectorsPerClusterShift > 25 - bytesPerSectorShift) return false;
+    if (head[110] != 1 && head[110] != 2) return false;
+
+    result->type = "exfat";
+    result->uuid = FormatSerial(head + 100);
+
+    // The label is an entry in the root directory
+    uint64_t heapOffset = Le32(head + 88);
+    uint64_t rootCluster = Le32(head + 96);
+    if (rootCluster < 2) return true;
+    uint64_t rootSector = heapOffset + ((rootCluster - 2) << sectorsPerClusterShift);
+    uint8_t dir[kProbeSize];
+    if (!read(dir, sizeof(dir), rootSector << bytesPerSectorShift)) return true;
+
+    for (size_t off = 0; off + 32 <= sizeof(dir); off += 32) {
+        const uint8_t* entry = dir + off;
+        if (entry[0] == 0x00) break;  // End of directory
+        if (entry[0] == 0x83) {       // Volume label
+            result->label = Utf16ToUtf8(entry + 2, std::min<size_t>(entry[1], 11));
+            break;
+        }
+    }
+    return true;
+}
+
+static std::string FatLabel(const uint8_t* p) {
+    std::string label(reinterpret_cast<const char*>(p), 11);
+    while (!label.empty() && (label.back() == ' ' || label.back() == '\0')) label.pop_back();
+    if (!label.empty() && label[0] == 0x05) label[0] = char(0xE5);
+    return label;
+}
+
+static bool ProbeVfat(const uint8_t* head, const ReadFn& read, FsProbeResult* result) {
+    if (head[0] != 0xEB && head[0] != 0xE9) return false;
+    if (memcmp(head + 3, "NTFS    ", 8) == 0) return false;
+
+    uint32_t bytesPerSector = Le16(head + 11);
+    uint32_t sectorsPerCluster = head[13];
+    uint32_t reservedSectors = Le16(head + 14);
+    uint32_t fats = head[16];
+    uint32_t rootEntries = Le16(head + 17);
+    uint32_t media = head[21];
+    if (bytesPerSector < 512 || bytesPerSector > 4096 || !IsPowerOfTwo(bytesPerSector)) {
+        return false;
+    }
+    if (!IsPowerOfTwo(sectorsPerCluster) || reservedSectors == 0 || fats == 0) return false;
+    if (media != 0xF0 && media < 0xF8) return false;
+
+    // FAT32 keeps the 16-bit FAT size at zero and moves the extended BPB
+    uint32_t fatSize = Le16(head + 22);
+    bool fat32 = fatSize == 0;
+    if (fat32) fatSize = Le32(head + 36);
+    if (fatSize == 0) return false;
+    const uint8_t* ebpb = head + (fat32 ? 64 : 36);
+    bool haveEbpb = ebpb[2] == 0x29;
+
+    result->type = "vfat";
+    if (haveEbpb) result->uuid = FormatSerial(ebpb + 3);
+
+    // Like blkid, prefer the volume label entry in the root directory over
+    // the copy in the boot sector, which tools often leave stale
+    uint64_t rootSector = reservedSectors + uint64_t(fats) * fatSize;
+    size_t rootSize = kProbeSize;
+    if (fat32) {
+        uint64_t rootCluster = Le32(head + 44);
+        if (rootCluster < 2) rootCluster = 2;
+        rootSector += (rootCluster - 2) * sectorsPerCluster;
+    } else {
+        rootSize = std::min<size_t>(rootSize, rootEntries * 32);
+    }
+    uint8_t dir[kProbeSize];
+    if (rootSize > 0 && read(dir, sizeof(dir), rootSector * bytesPerSector)) {
+        for (size_t off = 0; off + 32 <= rootSize; off += 32) {
+            const uint8_t* entry = dir + off;
+            if (entry[0] == 0x00) break;     // End of directory
+            if (entry[0] == 0xE5) continue;  // Deleted
+            // Volume ID, but not a long file name fragment
+            if ((entry[11] & 0x08) && (entry[11] & 0x0F) != 0x0F) {
+                result->label = FatLabel(entry);
+                return true;
+            }
+        }
+    }
+    if (haveEbpb) {
+        std::string label = FatLabel(ebpb + 7);
+        if (label != "NO NAME") result->label = label;
+    }
+    return true;
+}
+
+static status_t Probe(const ReadFn& read, FsProbeResult* result) {
+    *result = {};
+    uint8_t head[kProbeSize];
+    if (!read(head, sizeof(head), 0)) return -EIO;
+
+    // Superblock magics first: mkfs for these doesn't always wipe a FAT boot
+    // sector left at the start of the device
+    if (ProbeExt(head, result) || ProbeF2fs(head, result) || ProbeExfat(head, read, result) ||
+        ProbeVfat(head, read, result)) {
+        return OK;
+    }
+    *result = {};
+    return -EINVAL;
+}
+
+status_t ProbeFilesystem(int fd, FsProbeResult* result) {
+    return Probe(
+            [fd](uint8_t* buf, size_t len, uint64_t offset) {
+                size_t done = 0;
+                while (done < len) {
+                    ssize_t n = TEMP_FAILURE_RETRY(pread64(fd, buf + done, len - done,
+                                                           offset + done));
+                    if (n < 0) return false;
+                    if (n == 0) break;
+                    done += n;
+                }
+                memset(buf + done, 0, len - done);
+                return true;
+            },
+            result);
+}
+
+status_t ProbeFilesystem(const uint8_t* data, size_t size, FsProbeResult* result) {
+    return Probe(
+            [data, size](uint8_t* buf, size_t len, uint64_t offset) {
+                size_t avail = offset < size ? std::min<uint64_t>(size - offset, len) : 0;
+                if (avail > 0) memcpy(buf, data + offset, avail);
+                memset(buf + avail, 0, len - avail);
+                return true;
+            },
+            result);
+}
+
+}  // namespace vold
+}  // namespace android
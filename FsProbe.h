@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_FS_PROBE_H
+#define ANDROID_VOLD_FS_PROBE_H
+
+#include <utils/Errors.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace android {
+namespace vold {
+
+/*
+ * In-process replacement for "blkid -s TYPE -s UUID -s LABEL" covering the
+ * filesystems vold mounts: vfat, exfat, ext2/3/4 and f2fs. The values are
+ * formatted the way blkid prints them.
+ *
+ * The superblock is untrusted input: every field is bounds checked, and at
+ * most two 4 KiB reads are made, one at the start of the device and one at
+ * the root directory for FAT and exFAT volume labels.
+ */
+struct FsProbeResult {
+    std::string type;
+    std::string uuid;
+    std::string label;
+};
+
+/* Probes the block device open on |fd|; -EINVAL if nothing is recognized */
+status_t ProbeFilesystem(int fd, FsProbeResult* result);
+
+/* Probes an in-memory image of the start of a device */
+status_t ProbeFilesystem(const uint8_t* data, size_t size, FsProbeResult* result);
+
+}  // namespace vold
+}  // namespace android
+
+#endif
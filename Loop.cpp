@@ -31,17 +31,25 @@
 
 #include <linux/kdev_t.h>
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
-#include <fs_mgr/file_wait.h>
 #include <utils/Trace.h>
 
+#include "DirentReader.h"
+#include "FileWaiter.h"
 #include "Loop.h"
 #include "VoldUtil.h"
+#include "WorkStealingPool.h"
 #include "sehandle.h"
 
 using namespace std::literals;
@@ -50,22 +58,161 @@ using android::base::unique_fd;
 
 static const char* kVoldPrefix = "vold:";
 static constexpr size_t kLoopDeviceRetryAttempts = 3u;
+// Enough for an OBB mount and the one queued behind it
+static constexpr size_t kLoopPoolSize = 2u;
+
+namespace {
+
+struct FreeLoop {
+    int num;
+    unique_fd fd;
+};
+
+std::mutex sPoolLock;
+std::deque<FreeLoop> sPool;
+bool sRefilling = false;
+
+}  // namespace
+
+static std::string DevicePath(int num) {
+    return StringPrintf("/dev/block/loop%d", num);
+}
+
+static unique_fd OpenDevice(int num) {
+    std::string path = DevicePath(num);
+    if (android::vold::FileWaiter::Instance()->waitFor(path, 2s) != android::OK) {
+        LOG(ERROR) << "Failed to find " << path;
+        errno = ENOENT;
+        return {};
+    }
+    unique_fd fd(open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (fd.get() == -1) {
+        PLOG(ERROR) << "Failed to open " << path;
+    }
+    return fd;
+}
+
+// LOOP_CTL_GET_FREE keeps returning devices already in the pool since none
+// of them are bound, so walk up from it and add devices by number
+static void RefillPool() {
+    unique_fd ctl_fd(open("/dev/loop-control", O_RDWR | O_CLOEXEC));
+    int num = ctl_fd.get() == -1 ? -1 : ioctl(ctl_fd.get(), LOOP_CTL_GET_FREE);
+    if (num == -1) {
+        PLOG(WARNING) << "Failed to find a free loop device";
+    }
+    for (; num != -1 && num < Loop::LOOP_MAX; num++) {
+        {
+            std::lock_guard<std::mutex> lock(sPoolLock);
+            if (sPool.size() >= kLoopPoolSize) break;
+            if (std::any_of(sPool.begin(), sPool.end(),
+                            [num](const FreeLoop& loop) { return loop.num == num; })) {
+                continue;
+            }
+        }
+        if (ioctl(ctl_fd.get(), LOOP_CTL_ADD, num) == -1 && errno != EEXIST) {
+            PLOG(WARNING) << "Failed to add loop device " << num;
+            break;
+        }
+        unique_fd fd = OpenDevice(num);
+        if (fd.get() == -1) break;
+
+        // ENXIO means nothing is bound to it
+        struct loop_info64 li;
+        if (ioctl(fd.get(), LOOP_GET_STATUS64, &li) == -1 && errno == ENXIO) {
+            std::lock_guard<std::mutex> lock(sPoolLock);
+            sPool.push_back({num, std::move(fd)});
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(sPoolLock);
+    sRefilling = false;
+}
+
+void Loop::warmPool() {
+    {
+        std::lock_guard<std::mutex> lock(sPoolLock);
+        if (sRefilling || sPool.size() >= kLoopPoolSize) return;
+        sRefilling = true;
+    }
+    std::thread(RefillPool).detach();
+}
+
+// Takes a free device from the pool, or finds one the slow way if it is empty
+static int AcquireDevice(int* num, unique_fd* device_fd) {
+    {
+        std::lock_guard<std::mutex> lock(sPoolLock);
+        if (!sPool.empty()) {
+            *num = sPool.front().num;
+            *device_fd = std::move(sPool.front().fd);
+            sPool.pop_front();
+            return 0;
+        }
+    }
 
-int Loop::create(const std::string& target, std::string& out_device) {
     unique_fd ctl_fd(open("/dev/loop-control", O_RDWR | O_CLOEXEC));
     if (ctl_fd.get() == -1) {
         PLOG(ERROR) << "Failed to open loop-control";
         return -errno;
     }
-
-    int num = ioctl(ctl_fd.get(), LOOP_CTL_GET_FREE);
-    if (num == -1) {
+    *num = ioctl(ctl_fd.get(), LOOP_CTL_GET_FREE);
+    if (*num == -1) {
         PLOG(ERROR) << "Failed LOOP_CTL_GET_FREE";
         return -errno;
     }
+    *device_fd = OpenDevice(*num);
+    return device_fd->get() == -1 ? -errno : 0;
+}
 
-    out_device = StringPrintf("/dev/block/loop%d", num);
+// Kernels before 5.8 lack LOOP_CONFIGURE and need one ioctl per setting
+static int ConfigureLegacy(int device_fd, int target_fd, const Loop::Options& options) {
+    if (ioctl(device_fd, LOOP_SET_FD, target_fd) == -1) {
+        if (errno == EBUSY) return -EBUSY;
+        PLOG(ERROR) << "Failed to LOOP_SET_FD";
+        return -errno;
+    }
 
+    struct loop_info64 li;
+    memset(&li, 0, sizeof(li));
+    strlcpy((char*)li.lo_crypt_name, kVoldPrefix, LO_NAME_SIZE);
+    if (ioctl(device_fd, LOOP_SET_STATUS64, &li) == -1) {
+        PLOG(ERROR) << "Failed to LOOP_SET_STATUS64";
+        int res = -errno;
+        ioctl(device_fd, LOOP_CLR_FD, 0);
+        return res;
+    }
+    if (options.blockSize != 0 && ioctl(device_fd, LOOP_SET_BLOCK_SIZE, options.blockSize) == -1) {
+        PLOG(ERROR) << "Failed to LOOP_SET_BLOCK_SIZE";
+        int res = -errno;
+        ioctl(device_fd, LOOP_CLR_FD, 0);
+        return res;
+    }
+    if (options.directIo && ioctl(device_fd, LOOP_SET_DIRECT_IO, 1) == -1) {
+        PLOG(WARNING) << "Failed to LOOP_SET_DIRECT_IO; using the page cache";
+    }
+    return 0;
+}
+
+// Binds |target_fd| and applies every setting in a single ioctl
+static int Configure(int device_fd, int target_fd, const Loop::Options& options) {
+    struct loop_config config;
+    memset(&config, 0, sizeof(config));
+    config.fd = target_fd;
+    config.block_size = options.blockSize;
+    if (options.directIo) config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+    strlcpy((char*)config.info.lo_crypt_name, kVoldPrefix, LO_NAME_SIZE);
+
+    if (ioctl(device_fd, LOOP_CONFIGURE, &config) == 0) return 0;
+    if (errno == ENOTTY) return ConfigureLegacy(device_fd, target_fd, options);
+    if (errno == EBUSY) return -EBUSY;
+    PLOG(ERROR) << "Failed to LOOP_CONFIGURE";
+    return -errno;
+}
+
+int Loop::create(const std::string& target, std::string& out_device) {
+    return create(target, Options(), out_device);
+}
+
+int Loop::create(const std::string& target, const Options& options, std::string& out_device) {
     unique_fd target_fd;
     for (size_t i = 0; i != kLoopDeviceRetryAttempts; ++i) {
         target_fd.reset(open(target.c_str(), O_RDWR | O_CLOEXEC));
@@ -78,30 +225,24 @@ int Loop::create(const std::string& target, std::string& out_device) {
         PLOG(ERROR) << "Failed to open " << target;
         return -errno;
     }
-    if (!android::fs_mgr::WaitForFile(out_device, 2s)) {
-        LOG(ERROR) << "Failed to find " << out_device;
-        return -ENOENT;
-    }
-    unique_fd device_fd(open(out_device.c_str(), O_RDWR | O_CLOEXEC));
-    if (device_fd.get() == -1) {
-        PLOG(ERROR) << "Failed to open " << out_device;
-        return -errno;
-    }
 
-    if (ioctl(device_fd.get(), LOOP_SET_FD, target_fd.get()) == -1) {
-        PLOG(ERROR) << "Failed to LOOP_SET_FD";
-        return -errno;
+    // A pooled device can be bound by someone else after it was opened, in
+    // which case the kernel says EBUSY and the next one is tried
+    int res = -EBUSY;
+    for (size_t i = 0; i != kLoopDeviceRetryAttempts && res == -EBUSY; ++i) {
+        int num = -1;
+        unique_fd device_fd;
+        res = AcquireDevice(&num, &device_fd);
+        if (res != 0) break;
+        out_device = DevicePath(num);
+        res = Configure(device_fd.get(), target_fd.get(), options);
     }
-
-    struct loop_info64 li;
-    memset(&li, 0, sizeof(li));
-    strlcpy((char*)li.lo_crypt_name, kVoldPrefix, LO_NAME_SIZE);
-    if (ioctl(device_fd.get(), LOOP_SET_STATUS64, &li) == -1) {
-        PLOG(ERROR) << "Failed to LOOP_SET_STATUS64";
-        return -errno;
+    if (res == -EBUSY) {
+        LOG(ERROR) << "Failed to find an unused loop device for " << target;
     }
 
-    return 0;
+    warmPool();
+    return res;
 }
 
 int Loop::destroyByDevice(const char* loopDevice) {
@@ -123,48 +264,112 @@ int Loop::destroyByDevice(const char* loopDevice) {
     return 0;
 }
 
-int Loop::destroyAll() {
-    ATRACE_NAME("Loop::destroyAll");
+// Backing files under these belong to apexd and the like, which can own
+// hundreds of loop devices; vold only ever backs its own with files on /data
+static const char* kForeignBackingPrefixes[] = {
+        "/apex/", "/data/apex/", "/odm/", "/product/", "/system/", "/system_ext/", "/vendor/",
+};
+
+static bool IsForeignBacking(const std::string& backing) {
+    auto matches = [&](const char* prefix) { return android::base::StartsWith(backing, prefix); };
+    return std::any_of(std::begin(kForeignBackingPrefixes), std::end(kForeignBackingPrefixes),
+                       matches);
+}
+
+// Loop devices that might be ours, judged from sysfs without opening any of
+// them: /sys/block/loopN/loop only exists while something is bound. False if
+// sysfs can't be read, in which case every node has to be checked.
+static bool FindBoundDevices(std::vector<std::string>* devices) {
+    unique_fd dir_fd(open("/sys/block", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (dir_fd.get() == -1) {
+        PLOG(WARNING) << "Failed to open /sys/block";
+        return false;
+    }
+
+    android::vold::DirentReader reader(dir_fd.get());
+    android::vold::DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        if (!android::base::StartsWith(entry.name, "loop")) continue;
+
+        std::string backing;
+        std::string path = StringPrintf("%s/loop/backing_file", entry.name);
+        unique_fd fd(openat(dir_fd.get(), path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd.get() == -1) {
+            if (errno == ENOENT) continue;
+        } else if (android::base::ReadFdToString(fd.get(), &backing) && IsForeignBacking(backing)) {
+            continue;
+        }
+        devices->push_back(StringPrintf("/dev/block/%s", entry.name));
+    }
+    if (reader.error() != 0) {
+        errno = reader.error();
+        PLOG(WARNING) << "Failed to read /sys/block";
+        return false;
+    }
+    return true;
+}
 
+static bool FindAllDevices(std::vector<std::string>* devices) {
     std::string root = "/dev/block/";
     auto dirp = std::unique_ptr<DIR, int (*)(DIR*)>(opendir(root.c_str()), closedir);
     if (!dirp) {
         PLOG(ERROR) << "Failed to opendir";
-        return -1;
+        return false;
     }
 
-    // Poke through all devices looking for loops
     struct dirent* de;
     while ((de = readdir(dirp.get()))) {
-        auto test = std::string(de->d_name);
-        if (!android::base::StartsWith(test, "loop")) continue;
+        if (!android::base::StartsWith(de->d_name, "loop")) continue;
+        devices->push_back(root + de->d_name);
+    }
+    return true;
+}
 
-        auto path = root + de->d_name;
-        unique_fd fd(open(path.c_str(), O_RDWR | O_CLOEXEC));
-        if (fd.get() == -1) {
-            if (errno != ENOENT) {
-                PLOG(WARNING) << "Failed to open " << path;
-            }
-            continue;
+// The tag is the only thing that proves a device is ours
+static void DestroyIfTagged(const std::string& path) {
+    unique_fd fd(open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (fd.get() == -1) {
+        if (errno != ENOENT) {
+            PLOG(WARNING) << "Failed to open " << path;
         }
+        return;
+    }
 
-        struct loop_info64 li;
-        if (ioctl(fd.get(), LOOP_GET_STATUS64, &li) < 0) {
-            if (errno != ENXIO) {
-                PLOG(WARNING) << "Failed to LOOP_GET_STATUS64 " << path;
-            }
-            continue;
+    struct loop_info64 li;
+    if (ioctl(fd.get(), LOOP_GET_STATUS64, &li) < 0) {
+        if (errno != ENXIO) {
+            PLOG(WARNING) << "Failed to LOOP_GET_STATUS64 " << path;
         }
+        return;
+    }
 
-        auto id = std::string((char*)li.lo_crypt_name);
-        if (android::base::StartsWith(id, kVoldPrefix)) {
-            LOG(DEBUG) << "Tearing down stale loop device at " << path << " named " << id;
+    auto id = std::string((char*)li.lo_crypt_name);
+    if (android::base::StartsWith(id, kVoldPrefix)) {
+        LOG(DEBUG) << "Tearing down stale loop device at " << path << " named " << id;
 
-            if (ioctl(fd.get(), LOOP_CLR_FD, 0) < 0) {
-                PLOG(WARNING) << "Failed to LOOP_CLR_FD " << path;
-            }
+        if (ioctl(fd.get(), LOOP_CLR_FD, 0) < 0) {
+            PLOG(WARNING) << "Failed to LOOP_CLR_FD " << path;
         }
     }
+}
+
+int Loop::destroyAll() {
+    ATRACE_NAME("Loop::destroyAll");
+
+    std::vector<std::string> devices;
+    if (!FindBoundDevices(&devices)) {
+        devices.clear();
+        if (!FindAllDevices(&devices)) return -1;
+    }
+    if (devices.empty()) return 0;
+
+    // LOOP_CLR_FD waits for outstanding I/O, so don't do them one by one
+    android::vold::WorkStealingPool pool(
+            std::min(devices.size(), android::vold::WorkStealingPool::DefaultThreads()));
+    for (const auto& path : devices) {
+        pool.submit([&path] { DestroyIfTagged(path); });
+    }
+    pool.wait();
 
     return 0;
 }
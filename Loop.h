@@ -19,14 +19,25 @@
 
 #include <linux/loop.h>
 #include <unistd.h>
+#include <cstdint>
 #include <string>
 
 class Loop {
   public:
     static const int LOOP_MAX = 4096;
 
+    struct Options {
+        /* Read the backing file with O_DIRECT instead of through the page cache */
+        bool directIo = false;
+        /* Logical block size in bytes; 0 keeps the kernel default of 512 */
+        uint32_t blockSize = 0;
+    };
+
   public:
     static int create(const std::string& file, std::string& out_device);
+    static int create(const std::string& file, const Options& options, std::string& out_device);
+    /* Keeps a few free loop devices open in the background for create() to use */
+    static void warmPool();
     static int destroyByDevice(const char* loopDevice);
     static int destroyAll();
     static int createImageFile(const char* file, unsigned long numSectors);
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MountTree.h"
+
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include <sys/sysmacros.h>
+
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+namespace android {
+namespace vold {
+
+// The kernel writes space, tab, newline and backslash in paths as \ooo
+static std::string Unescape(std::string_view field) {
+    std::string out;
+    out.reserve(field.size());
+    for (size_t i = 0; i < field.size(); i++) {
+        if (field[i] == '\\' && i + 3 < field.size() && field[i + 1] >= '0' &&
+            field[i + 1] <= '3' && field[i + 2] >= '0' && field[i + 2] <= '7' &&
+            field[i + 3] >= '0' && field[i + 3] <= '7') {
+            out += char(((field[i + 1] - '0') << 6) | ((field[i + 2] - '0') << 3) |
+                        (field[i + 3] - '0'));
+            i += 3;
+        } else {
+            out += field[i];
+        }
+    }
+    return out;
+}
+
+// "36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+static bool ParseLine(const std::string& line, MountTree::Mount* mount) {
+    auto fields = android::base::Split(line, " ");
+    auto sep = std::find(fields.begin(), fields.end(), "-");
+    if (std::distance(fields.begin(), sep) < 6 || std::distance(sep, fields.end()) < 3) {
+        return false;
+    }
+
+    unsigned int devMajor, devMinor;
+    auto colon = fields[2].find(':');
+    if (colon == std::string::npos || !android::base::ParseInt(fields[0], &mount->id) ||
+        !android::base::ParseInt(fields[1], &mount->parentId) ||
+        !android::base::ParseUint(fields[2].substr(0, colon), &devMajor) ||
+        !android::base::ParseUint(fields[2].substr(colon + 1), &devMinor)) {
+        return false;
+    }
+    mount->dev = makedev(devMajor, devMinor);
+    mount->root = Unescape(fields[3]);
+    mount->mountPoint = Unescape(fields[4]);
+    mount->fsType = Unescape(*(sep + 1));
+    mount->source = Unescape(*(sep + 2));
+    return true;
+}
+
+bool MountTree::load(const std::string& path) {
+    std::string mountinfo;
+    if (!android::base::ReadFileToString(path, &mountinfo)) return false;
+    parse(mountinfo);
+    return true;
+}
+
+void MountTree::parse(const std::string& mountinfo) {
+    mMounts.clear();
+    for (const auto& line : android::base::Split(mountinfo, "\n")) {
+        Mount mount;
+        if (ParseLine(line, &mount)) mMounts.push_back(std::move(mount));
+    }
+
+    std::unordered_map<int, size_t> byId;
+    for (size_t i = 0; i < mMounts.size(); i++) byId.emplace(mMounts[i].id, i);
+
+    // The namespace root names a parent outside the namespace, or itself.
+    // mountinfo lists mounts in the order they were attached, so walking it
+    // backwards puts the newest children first: a mount over the parent's
+    // root has to go before one that was reached through that root.
+    for (size_t i = mMounts.size(); i-- > 0;) {
+        auto it = byId.find(mMounts[i].parentId);
+        if (it == byId.end() || it->second == i) continue;
+        mMounts[i].parent = it->second;
+        mMounts[it->second].children.push_back(i);
+    }
+}
+
+std::vector<size_t> MountTree::postOrder(size_t root) const {
+    std::vector<size_t> order;
+    // Parents come from the input, so guard against loops in it
+    std::vector<char> visited(mMounts.size());
+    std::vector<std::pair<size_t, size_t>> stack = {{root, 0}};
+    visited[root] = true;
+    while (!stack.empty()) {
+        auto& [index, next] = stack.back();
+        const auto& children = mMounts[index].children;
+        if (next < children.size()) {
+            size_t child = children[next++];
+            if (!visited[child]) {
+                visited[child] = true;
+                stack.push_back({child, 0});
+            }
+        } else {
+            order.push_back(index);
+            stack.pop_back();
+        }
+    }
+    return order;
+}
+
+}  // namespace vold
+}  // namespace android
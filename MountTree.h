@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_MOUNT_TREE_H
+#define ANDROID_VOLD_MOUNT_TREE_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * The mount table of a namespace as a tree, parsed from mountinfo. Unlike
+ * /proc/mounts, mountinfo says which mount each one sits on, so stacked and
+ * nested mounts can be unmounted children first without guessing from the
+ * order of the lines.
+ */
+class MountTree {
+  public:
+    static constexpr size_t kNoParent = static_cast<size_t>(-1);
+
+    struct Mount {
+        int id;
+        int parentId;
+        dev_t dev;
+        /* Directory of the filesystem mounted here, "/" for a whole filesystem */
+        std::string root;
+        std::string mountPoint;
+        std::string fsType;
+        std::string source;
+        /* Indices into mounts(); kNoParent for the namespace root */
+        size_t parent = kNoParent;
+        /* Newest first */
+        std::vector<size_t> children;
+    };
+
+    /* Reads |path|, by default the caller's own namespace; false if it can't be read */
+    bool load(const std::string& path = "/proc/self/mountinfo");
+    /* Parses the contents of a mountinfo file; malformed lines are skipped */
+    void parse(const std::string& mountinfo);
+
+    /* In mountinfo order */
+    const std::vector<Mount>& mounts() const { return mMounts; }
+
+    /*
+     * |root| and every mount on top of it, children before their parents and
+     * newer siblings before older ones
+     */
+    std::vector<size_t> postOrder(size_t root) const;
+
+  private:
+    std::vector<Mount> mMounts;
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
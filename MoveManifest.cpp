@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MoveManifest.h"
+#include "DirentReader.h"
+#include "TreeDelete.h"
+#include "Utils.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+static const char* kManifestName = ".vold_move_manifest";
+static const char* kManifestMagic = "vold_move_manifest 1";
+static const char* kCopyCompleteRecord = "complete";
+
+// A batch is committed when either limit is reached; each commit costs a
+// syncfs() of the target, so these trade resume granularity for throughput.
+static constexpr size_t kBatchRecords = 4096;
+static constexpr std::chrono::seconds kBatchInterval(2);
+
+static int64_t ctimeNs(const struct stat& st) {
+    return st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+}
+
+// Computes the same fingerprint TreeCopy accumulates while copying.
+static bool summarizeTree(int dirFd, TreeSummary* summary) {
+    struct stat st;
+    if (fstat(dirFd, &st) != 0) return false;
+    summary->newestCtimeNs = ctimeNs(st);
+
+    DirentReader reader(dirFd);
+    DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        if (fstatat(dirFd, entry.name, &st, AT_SYMLINK_NOFOLLOW) != 0) return false;
+        if (S_ISDIR(st.st_mode)) {
+            unique_fd child(openat(dirFd, entry.name,
+                                   O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+            TreeSummary sub;
+            if (child == -1 || !summarizeTree(child, &sub)) return false;
+            summary->add(sub);
+        } else {
+            if (S_ISREG(st.st_mode)) summary->bytes += st.st_size;
+            summary->entries++;
+            summary->newestCtimeNs = std::max(summary->newestCtimeNs, ctimeNs(st));
+        }
+    }
+    return reader.error() == 0;
+}
+
+// Parses "d <bytes> <entries> <ctime> <path>"; the path may contain spaces.
+static bool parseRecord(const std::string& line, std::string* relPath, TreeSummary* summary) {
+    if (!android::base::StartsWith(line, "d ")) return false;
+    size_t pos = 2;
+    std::string fields[3];
+    for (auto& field : fields) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) return false;
+        field = line.substr(pos, end - pos);
+        pos = end + 1;
+    }
+    if (!android::base::ParseUint(fields[0], &summary->bytes) ||
+        !android::base::ParseUint(fields[1], &summary->entries) ||
+        !android::base::ParseInt(fields[2], &summary->newestCtimeNs)) {
+        return false;
+    }
+    *relPath = line.substr(pos);
+    return !relPath->empty();
+}
+
+// Parses "complete <bytes> <entries> <ctime>"
+static bool parseCompleteRecord(const std::string& line, TreeSummary* summary) {
+    auto fields = android::base::Split(line, " ");
+    return fields.size() == 4 && fields[0] == kCopyCompleteRecord &&
+           android::base::ParseUint(fields[1], &summary->bytes) &&
+           android::base::ParseUint(fields[2], &summary->entries) &&
+           android::base::ParseInt(fields[3], &summary->newestCtimeNs);
+}
+
+// Removes what |dstFd| holds that |srcFd| no longer does, or holds with
+// another type. Like the "rm" of a fresh move, the top level directories of
+// the target are only emptied, not removed.
+static status_t pruneDir(int srcFd, int dstFd, const std::string& dstPath, bool isRoot) {
+    status_t res = OK;
+    DirentReader reader(dstFd);
+    DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        if (isRoot && !strcmp(entry.name, kManifestName)) continue;
+        std::string path = dstPath + "/" + entry.name;
+
+        struct stat dst;
+        struct stat src;
+        if (fstatat(dstFd, entry.name, &dst, AT_SYMLINK_NOFOLLOW) != 0) {
+            PLOG(WARNING) << "Failed to stat " << path;
+            res = -errno;
+            continue;
+        }
+        bool gone = false;
+        if (fstatat(srcFd, entry.name, &src, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno != ENOENT) {
+                PLOG(WARNING) << "Failed to stat source of " << path;
+                res = -errno;
+                continue;
+            }
+            gone = true;
+        } else {
+            gone = (src.st_mode & S_IFMT) != (dst.st_mode & S_IFMT);
+        }
+
+        if (gone) {
+            LOG(VERBOSE) << "Pruning " << path;
+            if (S_ISDIR(dst.st_mode)) {
+                status_t deleted = TreeDelete(path, isRoot ? 1 : 0).run();
+                if (deleted != OK) res = deleted;
+            } else if (unlinkat(dstFd, entry.name, 0) != 0) {
+                PLOG(WARNING) << "Failed to prune " << path;
+                res = -errno;
+            }
+        } else if (S_ISDIR(dst.st_mode)) {
+            unique_fd srcChild(
+                    openat(srcFd, entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+            unique_fd dstChild(
+                    openat(dstFd, entry.name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+            if (srcChild == -1 || dstChild == -1) {
+                PLOG(WARNING) << "Failed to open " << path << " or its source";
+                res = -errno;
+                continue;
+            }
+            status_t pruned = pruneDir(srcChild, dstChild, path, false);
+            if (pruned != OK) res = pruned;
+        }
+    }
+    if (reader.error() != 0) {
+        LOG(WARNING) << "Failed to read " << dstPath << ": " << strerror(reader.error());
+        res = -reader.error();
+    }
+    return res;
+}
+
+MoveManifest::MoveManifest(const std::string& fromPath, const std::string& toPath)
+    : mFromPath(fromPath), mToPath(toPath), mPath(toPath + "/" + kManifestName) {}
+
+bool MoveManifest::load() {
+    std::string contents;
+    if (!android::base::ReadFileToString(mPath, &contents)) {
+        if (errno != ENOENT) PLOG(WARNING) << "Failed to read " << mPath;
+        return false;
+    }
+
+    auto lines = android::base::Split(contents, "\n");
+    // The last element is either empty or a record torn by the interruption
+    lines.pop_back();
+    if (lines.size() < 3 || lines[0] != kManifestMagic || lines[1] != "from " + mFromPath ||
+        lines[2] != "to " + mToPath) {
+        LOG(WARNING) << "Ignoring manifest that doesn't describe this move: " << mPath;
+        return false;
+    }
+
+    mDone.clear();
+    mCopyComplete = false;
+    for (size_t i = 3; i < lines.size(); i++) {
+        std::string relPath;
+        TreeSummary summary;
+        if (parseCompleteRecord(lines[i], &summary)) {
+            mCopyComplete = true;
+            mCompleteSummary = summary;
+        } else if (parseRecord(lines[i], &relPath, &summary)) {
+            mDone[relPath] = summary;
+        }
+    }
+
+    mFd.reset(TEMP_FAILURE_RETRY(open(mPath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC)));
+    if (mFd == -1) {
+        PLOG(WARNING) << "Failed to reopen " << mPath;
+        mDone.clear();
+        mCopyComplete = false;
+        return false;
+    }
+    mLastCommit = std::chrono::steady_clock::now();
+    LOG(INFO) << "Loaded move manifest with " << mDone.size() << " completed subtrees"
+              << (mCopyComplete ? " and a finished copy" : "");
+    return true;
+}
+
+status_t MoveManifest::create() {
+    mDone.clear();
+    mCopyComplete = false;
+    mFd.reset(TEMP_FAILURE_RETRY(
+            open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600)));
+    if (mFd == -1) {
+        PLOG(ERROR) << "Failed to create " << mPath;
+        return -errno;
+    }
+
+    std::string header = std::string(kManifestMagic) + "\nfrom " + mFromPath + "\nto " + mToPath +
+                         "\n";
+    if (!android::base::WriteFully(mFd, header.data(), header.size()) || fsync(mFd) != 0) {
+        PLOG(ERROR) << "Failed to write " << mPath;
+        return -errno;
+    }
+    if (!FsyncDirectory(mToPath)) return -EIO;
+    mLastCommit = std::chrono::steady_clock::now();
+    return OK;
+}
+
+bool MoveManifest::isComplete(const std::string& relPath, int srcFd, TreeSummary* summary) {
+    auto it = mDone.find(relPath);
+    if (it == mDone.end()) return false;
+
+    // Walk through a private fd; |srcFd| shares its offset with the copier
+    unique_fd fd(openat(srcFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    TreeSummary current;
+    if (fd == -1 || !summarizeTree(fd, &current)) {
+        PLOG(WARNING) << "Failed to verify " << relPath << "; copying it again";
+        return false;
+    }
+    if (!(current == it->second)) {
+        LOG(INFO) << relPath << " changed since it was copied; copying it again";
+        return false;
+    }
+    *summary = current;
+    mReusedBytes.fetch_add(current.bytes, std::memory_order_relaxed);
+    return true;
+}
+
+void MoveManifest::onComplete(const std::string& relPath, const TreeSummary& summary) {
+    // Newlines would break the line based format; such a subtree just
+    // won't be resumable
+    if (relPath.find('\n') != std::string::npos) return;
+
+    bool due;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mPending += "d " + std::to_string(summary.bytes) + " " + std::to_string(summary.entries) +
+                    " " + std::to_string(summary.newestCtimeNs) + " " + relPath + "\n";
+        mPendingCount++;
+        due = mPendingCount >= kBatchRecords ||
+              std::chrono::steady_clock::now() - mLastCommit >= kBatchInterval;
+    }
+    if (due) commit(false);
+}
+
+status_t MoveManifest::commit(bool force) {
+    std::unique_lock<std::mutex> commitLock(mCommitLock, std::defer_lock);
+    if (force) {
+        commitLock.lock();
+    } else if (!commitLock.try_lock()) {
+        // Another worker is already committing; our records go next time
+        return OK;
+    }
+
+    std::string batch;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        batch.swap(mPending);
+        mPendingCount = 0;
+        mLastCommit = std::chrono::steady_clock::now();
+    }
+    if (batch.empty() || mFd == -1) return OK;
+
+    // Everything the batch describes has to hit the disk before the claim does
+    if (syncfs(mFd) != 0) {
+        PLOG(WARNING) << "Failed to syncfs " << mToPath;
+        return -errno;
+    }
+    if (!android::base::WriteFully(mFd, batch.data(), batch.size()) || fdatasync(mFd) != 0) {
+        PLOG(WARNING) << "Failed to append to " << mPath;
+        return -errno;
+    }
+    return OK;
+}
+
+status_t MoveManifest::flush() {
+    return commit(true);
+}
+
+status_t MoveManifest::markCopyComplete(const TreeSummary& summary) {
+    status_t res = flush();
+    if (res != OK) return res;
+
+    std::string record = std::string(kCopyCompleteRecord) + " " + std::to_string(summary.bytes) +
+                         " " + std::to_string(summary.entries) + " " +
+                         std::to_string(summary.newestCtimeNs) + "\n";
+    if (syncfs(mFd) != 0 || !android::base::WriteFully(mFd, record.data(), record.size()) ||
+        fdatasync(mFd) != 0) {
+        PLOG(ERROR) << "Failed to mark copy complete in " << mPath;
+        return -errno;
+    }
+    mCopyComplete = true;
+    mCompleteSummary = summary;
+    return OK;
+}
+
+bool MoveManifest::verifyCopyComplete() {
+    if (!mCopyComplete) return false;
+
+    // The source is still primary until the move reports success, so it may
+    // have been written to after the marker; never delete it unverified
+    mCopyComplete = false;
+    unique_fd fd(open(mFromPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    TreeSummary current;
+    if (fd == -1 || !summarizeTree(fd, &current)) {
+        PLOG(WARNING) << "Failed to verify " << mFromPath << "; copying it again";
+        return false;
+    }
+    if (!(current == mCompleteSummary)) {
+        LOG(INFO) << mFromPath << " changed since it was copied; copying it again";
+        return false;
+    }
+    mCopyComplete = true;
+    return true;
+}
+
+status_t MoveManifest::prune() {
+    unique_fd src(open(mFromPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    unique_fd dst(open(mToPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (src == -1 || dst == -1) {
+        PLOG(ERROR) << "Failed to open " << mFromPath << " or " << mToPath;
+        return -errno;
+    }
+    return pruneDir(src, dst, mToPath, true);
+}
+
+void MoveManifest::remove() {
+    mFd.reset();
+    mDone.clear();
+    mCopyComplete = false;
+    if (unlink(mPath.c_str()) != 0 && errno != ENOENT) {
+        PLOG(WARNING) << "Failed to remove " << mPath;
+        return;
+    }
+    FsyncDirectory(mToPath);
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_MOVE_MANIFEST_H
+#define ANDROID_VOLD_MOVE_MANIFEST_H
+
+#include "TreeCopy.h"
+
+#include <android-base/unique_fd.h>
+#include <utils/Errors.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace android {
+namespace vold {
+
+/*
+ * Append-only journal of the subtrees a MoveStorage copy has finished, kept
+ * in the root of the target volume so that a move interrupted by a vold crash
+ * or a reboot can pick up where it stopped.
+ *
+ * Records are batched, and each batch is only written after a syncfs() of the
+ * target, so anything the manifest claims is already durable. On resume a
+ * subtree is skipped only if the source still has the same TreeSummary.
+ * Once the copy is done a final marker with the summary of the whole source
+ * is written, and trusted on resume only while the source still matches it.
+ * remove() is called once the copy is done and both volumes are back online,
+ * before the source is cleaned up: from then on there is nothing to resume.
+ */
+class MoveManifest : public TreeCopy::Journal {
+  public:
+    MoveManifest(const std::string& fromPath, const std::string& toPath);
+
+    /* Loads a manifest left by an earlier attempt at the same move */
+    bool load();
+    /* Starts an empty manifest, replacing anything left behind */
+    status_t create();
+    /* Writes out any batched records */
+    status_t flush();
+    /* Records that the whole tree, last seen as |summary|, has been copied */
+    status_t markCopyComplete(const TreeSummary& summary);
+    /* Drops a loaded copy-complete marker unless the source is unchanged since */
+    bool verifyCopyComplete();
+    /* Removes target entries whose source has disappeared since an earlier attempt */
+    status_t prune();
+    /* Deletes the manifest once the copy has finished or been abandoned */
+    void remove();
+
+    /* True if an earlier attempt already finished copying */
+    bool isCopyComplete() const { return mCopyComplete; }
+    /* Number of subtrees recorded by earlier attempts */
+    size_t resumableCount() const { return mDone.size(); }
+    /* Bytes in subtrees that were verified and reused instead of copied */
+    uint64_t reusedBytes() const { return mReusedBytes.load(std::memory_order_relaxed); }
+
+    bool isComplete(const std::string& relPath, int srcFd, TreeSummary* summary) override;
+    void onComplete(const std::string& relPath, const TreeSummary& summary) override;
+
+  private:
+    status_t commit(bool force);
+
+    const std::string mFromPath;
+    const std::string mToPath;
+    const std::string mPath;
+    android::base::unique_fd mFd;
+
+    // Subtrees completed by earlier attempts; read-only once the copy runs
+    std::unordered_map<std::string, TreeSummary> mDone;
+    bool mCopyComplete = false;
+    TreeSummary mCompleteSummary;
+    std::atomic<uint64_t> mReusedBytes{0};
+
+    std::mutex mLock;
+    std::string mPending;
+    size_t mPendingCount = 0;
+    std::chrono::steady_clock::time_point mLastCommit;
+    // Serializes the syncfs() + append of a batch
+    std::mutex mCommitLock;
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
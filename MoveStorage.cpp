@@ -15,25 +15,20 @@
  */
 
 #include "MoveStorage.h"
+#include "MoveManifest.h"
+#include "TreeCopy.h"
+#include "TreeDelete.h"
 #include "Utils.h"
 #include "VolumeManager.h"
 
 #include <android-base/logging.h>
-#include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <private/android_filesystem_config.h>
 #include <wakelock/wakelock.h>
 
-#include <thread>
-
-#include <dirent.h>
-#include <sys/wait.h>
-
-#define CONSTRAIN(amount, low, high) \
-    ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
-
-static const char* kPropBlockingExec = "persist.sys.blocking_exec";
+#include <chrono>
 
+using namespace std::chrono_literals;
 using android::base::StringPrintf;
 
 namespace android {
@@ -43,11 +38,10 @@ namespace vold {
 static const int kMoveSucceeded = -100;
 static const int kMoveFailedInternalError = -6;
 
-static const char* kCpPath = "/system/bin/cp";
-static const char* kRmPath = "/system/bin/rm";
-
 static const char* kWakeLock = "MoveTask";
 
+static constexpr std::chrono::milliseconds kProgressInterval = 1s;
+
 static void notifyProgress(int progress,
                            const android::sp<android::os::IVoldTaskListener>& listener) {
     if (listener) {
@@ -56,123 +50,68 @@ static void notifyProgress(int progress,
     }
 }
 
-static bool pushBackContents(const std::string& path, std::vector<std::string>& cmd,
-                             int searchLevels) {
-    if (searchLevels == 0) {
-        cmd.emplace_back(path);
-        return true;
-    }
-    auto dirp = std::unique_ptr<DIR, int (*)(DIR*)>(opendir(path.c_str()), closedir);
-    if (!dirp) {
-        PLOG(ERROR) << "Unable to open directory: " << path;
-        return false;
-    }
-    bool found = false;
-    struct dirent* ent;
-    while ((ent = readdir(dirp.get())) != NULL) {
-        if (IsDotOrDotDot(*ent)) continue;
-        auto subdir = path + "/" + ent->d_name;
-        found |= pushBackContents(subdir, cmd, searchLevels - 1);
-    }
-    return found;
-}
-
 static status_t execRm(const std::string& path, int startProgress, int stepProgress,
                        const android::sp<android::os::IVoldTaskListener>& listener) {
     notifyProgress(startProgress, listener);
 
-    uint64_t expectedBytes = GetTreeBytes(path);
-    uint64_t startFreeBytes = GetFreeBytes(path);
-
-    std::vector<std::string> cmd;
-    cmd.push_back(kRmPath);
-    cmd.push_back("-f"); /* force: remove without confirmation, no error if it doesn't exist */
-    cmd.push_back("-R"); /* recursive: remove directory contents */
-    if (!pushBackContents(path, cmd, 2)) {
-        LOG(WARNING) << "No contents in " << path;
-        return OK;
-    }
+    // Same scope as the old "rm -f -R path/*/*": the per-user directories
+    // directly below the volume root stay in place.
+    TreeDelete del(path, 2, true /* countBytes */);
+    status_t res = del.start();
+    if (res != OK) return res;
 
-    if (android::base::GetBoolProperty(kPropBlockingExec, false)) {
-        return ForkExecvp(cmd);
+    while (!del.waitFor(kProgressInterval)) {
+        notifyProgress(del.progress().scaled(startProgress, stepProgress), listener);
     }
 
-    pid_t pid = ForkExecvpAsync(cmd);
-    if (pid == -1) return -1;
-
-    int status;
-    while (true) {
-        if (waitpid(pid, &status, WNOHANG) == pid) {
-            if (WIFEXITED(status)) {
-                LOG(DEBUG) << "Finished rm with status " << WEXITSTATUS(status);
-                return (WEXITSTATUS(status) == 0) ? OK : -1;
-            } else {
-                break;
-            }
-        }
-
-        sleep(1);
-        uint64_t deltaFreeBytes = GetFreeBytes(path) - startFreeBytes;
-        notifyProgress(
-            startProgress +
-                CONSTRAIN((int)((deltaFreeBytes * stepProgress) / expectedBytes), 0, stepProgress),
-            listener);
-    }
-    return -1;
+    res = del.result();
+    LOG(DEBUG) << "Finished rm of " << del.inodes() << " inodes and " << del.bytes()
+               << " bytes with status " << res;
+    return res;
 }
 
 static status_t execCp(const std::string& fromPath, const std::string& toPath, int startProgress,
-                       int stepProgress,
+                       int stepProgress, MoveManifest* manifest,
                        const android::sp<android::os::IVoldTaskListener>& listener) {
     notifyProgress(startProgress, listener);
 
-    uint64_t expectedBytes = GetTreeBytes(fromPath);
+    // Refuse up front what can't fit. Anything an interrupted attempt left in
+    // the target is either reused or overwritten, so it's already paid for.
+    // TreeCopy writes every hard link out as a file of its own.
+    uint64_t expectedBytes = GetTreeBytes(fromPath, true /* countEveryLink */);
+    uint64_t presentBytes =
+            manifest->resumableCount() > 0 ? GetTreeBytes(toPath, true /* countEveryLink */) : 0;
+    if (presentBytes == (uint64_t)-1) presentBytes = 0;
     uint64_t startFreeBytes = GetFreeBytes(toPath);
 
-    if (expectedBytes > startFreeBytes) {
+    if (expectedBytes > startFreeBytes + presentBytes) {
         LOG(ERROR) << "Data size " << expectedBytes << " is too large to fit in free space "
-                   << startFreeBytes;
-        return -1;
-    }
-
-    std::vector<std::string> cmd;
-    cmd.push_back(kCpPath);
-    cmd.push_back("-p"); /* preserve timestamps, ownership, and permissions */
-    cmd.push_back("-R"); /* recurse into subdirectories (DEST must be a directory) */
-    cmd.push_back("-P"); /* Do not follow symlinks [default] */
-    cmd.push_back("-d"); /* don't dereference symlinks */
-    if (!pushBackContents(fromPath, cmd, 1)) {
-        LOG(WARNING) << "No contents in " << fromPath;
-        return OK;
-    }
-    cmd.push_back(toPath.c_str());
-
-    if (android::base::GetBoolProperty(kPropBlockingExec, false)) {
-        return ForkExecvp(cmd);
-    }
-
-    pid_t pid = ForkExecvpAsync(cmd);
-    if (pid == -1) return -1;
-
-    int status;
-    while (true) {
-        if (waitpid(pid, &status, WNOHANG) == pid) {
-            if (WIFEXITED(status)) {
-                LOG(DEBUG) << "Finished cp with status " << WEXITSTATUS(status);
-                return (WEXITSTATUS(status) == 0) ? OK : -1;
-            } else {
-                break;
-            }
+                   << startFreeBytes << " plus " << presentBytes << " already copied";
+        return -ENOSPC;
+    }
+
+    TreeCopy copy(fromPath, toPath);
+    copy.setJournal(manifest);
+    status_t res = copy.start();
+    if (res != OK) return res;
+
+    // Backstop for a source that grows while it's copied: give up as soon as
+    // what still has to be written can no longer fit.
+    while (!copy.waitFor(kProgressInterval)) {
+        uint64_t neededBytes = copy.progress().discoveredBytes() - manifest->reusedBytes();
+        if (neededBytes > startFreeBytes) {
+            LOG(ERROR) << "Data size " << neededBytes << " is too large to fit in free space "
+                       << startFreeBytes;
+            copy.cancel(-ENOSPC);
         }
-
-        sleep(1);
-        uint64_t deltaFreeBytes = startFreeBytes - GetFreeBytes(toPath);
-        notifyProgress(
-            startProgress +
-                CONSTRAIN((int)((deltaFreeBytes * stepProgress) / expectedBytes), 0, stepProgress),
-            listener);
+        notifyProgress(copy.progress().scaled(startProgress, stepProgress), listener);
     }
-    return -1;
+
+    res = copy.result();
+    LOG(DEBUG) << "Finished copy of " << copy.inodes() << " inodes and " << copy.bytes()
+               << " bytes with status " << res;
+    if (res == OK) res = manifest->markCopyComplete(copy.summary());
+    return res;
 }
 
 static void bringOffline(const std::shared_ptr<VolumeBase>& vol) {
@@ -194,6 +133,8 @@ static status_t moveStorageInternal(const std::shared_ptr<VolumeBase>& from,
                                     const android::sp<android::os::IVoldTaskListener>& listener) {
     std::string fromPath;
     std::string toPath;
+    std::unique_ptr<MoveManifest> manifest;
+    bool resuming = false;
 
     // TODO: add support for public volumes
     if (from->getType() != VolumeBase::Type::kEmulated) goto fail;
@@ -210,13 +151,31 @@ static status_t moveStorageInternal(const std::shared_ptr<VolumeBase>& from,
     fromPath = from->getInternalPath();
     toPath = to->getInternalPath();
 
-    // Step 2: clean up any stale data
-    if (execRm(toPath, 10, 10, listener) != OK) {
-        goto fail;
+    // A manifest left in the target by an interrupted attempt at this same
+    // move tells us which parts of the copy can be trusted
+    manifest = std::make_unique<MoveManifest>(fromPath, toPath);
+    resuming = manifest->load();
+
+    if (!resuming) {
+        // Step 2: clean up any stale data
+        if (execRm(toPath, 10, 10, listener) != OK) {
+            goto fail;
+        }
+        if (manifest->create() != OK) {
+            goto copy_fail;
+        }
+    } else {
+        LOG(INFO) << "Resuming move from " << fromPath << " to " << toPath;
+        // Anything deleted from the source since the last attempt must not
+        // come back with the move
+        if (!manifest->verifyCopyComplete() && manifest->prune() != OK) {
+            goto copy_fail;
+        }
     }
 
     // Step 3: perform actual copy
-    if (execCp(fromPath, toPath, 20, 60, listener) != OK) {
+    if (!manifest->isCopyComplete() &&
+        execCp(fromPath, toPath, 20, 60, manifest.get(), listener) != OK) {
         goto copy_fail;
     }
 
@@ -228,6 +187,9 @@ static status_t moveStorageInternal(const std::shared_ptr<VolumeBase>& from,
         bringOnline(from);
         bringOnline(to);
     }
+    // The target is now primary; a failed cleanup below must not leave a
+    // journal behind in it
+    manifest->remove();
 
     // Step 4: clean up old data
     if (execRm(fromPath, 85, 15, listener) != OK) {
@@ -242,6 +204,7 @@ copy_fail:
     // in target location. Do not check return value, we can not do any
     // useful anyway.
     execRm(toPath, 80, 1, listener);
+    manifest->remove();
 fail:
     // clang-format off
     {
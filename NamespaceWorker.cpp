@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NamespaceWorker.h"
+
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace android {
+namespace vold {
+
+NamespaceWorker* NamespaceWorker::sInstance = nullptr;
+
+NamespaceWorker* NamespaceWorker::Instance() {
+    static std::once_flag once;
+    std::call_once(once, [] { sInstance = new NamespaceWorker(); });
+    return sInstance;
+}
+
+NamespaceWorker::NamespaceWorker() {
+    mThread = std::thread(&NamespaceWorker::loop, this);
+    mThread.detach();
+}
+
+std::vector<bool> NamespaceWorker::run(std::vector<Job> jobs) {
+    if (jobs.empty()) return {};
+
+    std::future<std::vector<bool>> results;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mBatches.push_back({std::move(jobs), {}});
+        results = mBatches.back().results.get_future();
+    }
+    mBatchReady.notify_one();
+    return results.get();
+}
+
+bool NamespaceWorker::run(int nsFd, Operation op) {
+    std::vector<Job> jobs;
+    jobs.push_back({nsFd, std::move(op)});
+    return run(std::move(jobs))[0];
+}
+
+bool NamespaceWorker::runJob(const Job& job) {
+    if (!mReady) return false;
+    if (setns(job.nsFd, CLONE_NEWNS) != 0) {
+        PLOG(ERROR) << "Failed to setns";
+        return false;
+    }
+    return job.op();
+}
+
+void NamespaceWorker::loop() {
+    pthread_setname_np(pthread_self(), "vold_ns_worker");
+
+    // setns(CLONE_NEWNS) refuses a thread that shares its root and cwd with
+    // others, so give this one its own copy
+    if (unshare(CLONE_FS) != 0) {
+        PLOG(ERROR) << "Failed to unshare filesystem attributes; namespace jobs will fail";
+    } else {
+        mHomeNsFd.reset(open("/proc/thread-self/ns/mnt", O_RDONLY | O_CLOEXEC));
+        if (mHomeNsFd == -1) {
+            PLOG(ERROR) << "Failed to open own mount namespace; namespace jobs will fail";
+        } else {
+            mReady = true;
+        }
+    }
+
+    while (true) {
+        Batch batch;
+        {
+            std::unique_lock<std::mutex> lock(mLock);
+            mBatchReady.wait(lock, [this] { return !mBatches.empty(); });
+            batch = std::move(mBatches.front());
+            mBatches.pop_front();
+        }
+
+        std::vector<bool> results;
+        for (const auto& job : batch.jobs) {
+            results.push_back(runJob(job));
+        }
+        if (mReady && setns(mHomeNsFd, CLONE_NEWNS) != 0) {
+            // Staying in an app's namespace would be worse than doing nothing
+            PLOG(ERROR) << "Failed to return to own mount namespace";
+            mReady = false;
+        }
+        batch.results.set_value(std::move(results));
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_NAMESPACE_WORKER_H
+#define ANDROID_VOLD_NAMESPACE_WORKER_H
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * Runs mount operations inside other processes' mount namespaces without
+ * forking vold for each one.
+ *
+ * A single long-lived thread unshares its filesystem attributes from the
+ * rest of vold, which lets it setns() into a mount namespace on its own.
+ * It takes batches of jobs, enters each job's namespace in turn, runs the
+ * job there, and goes back to vold's namespace once the batch is done.
+ * That way it never keeps an app's namespace alive.
+ *
+ * Jobs run one at a time, in the order they were submitted.
+ */
+class NamespaceWorker {
+  public:
+    /* Runs inside the target namespace; returns whether it succeeded */
+    using Operation = std::function<bool()>;
+
+    struct Job {
+        /* A /proc/<pid>/ns/mnt fd, borrowed until run() returns */
+        int nsFd;
+        Operation op;
+    };
+
+    static NamespaceWorker* Instance();
+
+    /* Runs every job and returns whether each one succeeded, in order */
+    std::vector<bool> run(std::vector<Job> jobs);
+    bool run(int nsFd, Operation op);
+
+  private:
+    struct Batch {
+        std::vector<Job> jobs;
+        std::promise<std::vector<bool>> results;
+    };
+
+    NamespaceWorker();
+
+    void loop();
+    bool runJob(const Job& job);
+
+    /* vold's own namespace, to return to after each batch */
+    android::base::unique_fd mHomeNsFd;
+    bool mReady = false;
+
+    std::mutex mLock;
+    std::condition_variable mBatchReady;
+    std::deque<Batch> mBatches;
+
+    std::thread mThread;
+
+    static NamespaceWorker* sInstance;
+
+    DISALLOW_COPY_AND_ASSIGN(NamespaceWorker);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
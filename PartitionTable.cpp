@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PartitionTable.h"
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+
+using android::base::StringPrintf;
+
+namespace android {
+namespace vold {
+
+// Holds the MBR, the GPT header and sgdisk's default 128 entry array on disks
+// with 512 or 4096 byte sectors, so most tables take a single read
+static constexpr size_t kHeadSize = 32 * 1024;
+// Larger entry arrays, or ones further out, are left to sgdisk
+static constexpr uint64_t kMaxEntriesSize = 1024 * 1024;
+static constexpr uint64_t kMaxEntriesOffset = 64 * 1024 * 1024;
+
+static constexpr size_t kMbrSize = 512;
+static constexpr size_t kMbrEntriesOffset = 446;
+static constexpr size_t kMbrEntrySize = 16;
+static constexpr size_t kMbrEntries = 4;
+
+static constexpr size_t kGptHeaderMinSize = 92;
+static constexpr size_t kGptEntryMinSize = 128;
+static constexpr size_t kGuidSize = 16;
+
+static const char* kSgdiskToken = " \t\n";
+
+// Reads |len| bytes at |offset|, zero filling anything past the end.
+using ReadFn = std::function<bool(uint8_t* buf, size_t len, uint64_t offset)>;
+
+static uint16_t Le16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t Le32(const uint8_t* p) {
+    return Le16(p) | (uint32_t(Le16(p + 2)) << 16);
+}
+
+static uint64_t Le64(const uint8_t* p) {
+    return Le32(p) | (uint64_t(Le32(p + 4)) << 32);
+}
+
+static bool IsPowerOfTwo(uint32_t v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+static constexpr std::array<uint32_t, 256> MakeCrcTable() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < table.size(); i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint32_t, 256> kCrcTable = MakeCrcTable();
+
+// The CRC-32 GPT uses; passing the previous result in continues it
+static uint32_t Crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = kCrcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// The first three fields of a GUID are little endian on disk
+static std::string FormatGuid(const uint8_t* p) {
+    return StringPrintf("%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X", Le32(p), Le16(p + 4),
+                        Le16(p + 6), p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15]);
+}
+
+// A checked table, before its entries are decoded
+struct RawTable {
+    PartitionTable::Type type = PartitionTable::Type::kUnknown;
+    std::vector<uint8_t> head;
+    std::vector<uint8_t> entries;
+    uint32_t entrySize = 0;
+    uint32_t crc = 0;
+};
+
+enum class Gpt { kAbsent, kValid, kInvalid };
+
+static Gpt LoadGpt(const ReadFn& read, uint32_t sectorSize, RawTable* raw) {
+    const uint8_t* header = raw->head.data() + sectorSize;
+    if (memcmp(header, "EFI PART", 8) != 0) return Gpt::kAbsent;
+
+    uint32_t headerSize = Le32(header + 12);
+    if (headerSize < kGptHeaderMinSize || headerSize > sectorSize) {
+        LOG(WARNING) << "Invalid GPT header size " << headerSize;
+        return Gpt::kInvalid;
+    }
+    std::vector<uint8_t> zeroed(header, header + headerSize);
+    memset(zeroed.data() + 16, 0, 4);
+    if (Crc32(zeroed.data(), zeroed.size()) != Le32(header + 16)) {
+        LOG(WARNING) << "GPT header CRC mismatch";
+        return Gpt::kInvalid;
+    }
+    if (Le64(header + 24) != 1) {
+        LOG(WARNING) << "GPT header doesn't describe itself as primary";
+        return Gpt::kInvalid;
+    }
+
+    uint64_t entriesLba = Le64(header + 72);
+    uint32_t numEntries = Le32(header + 80);
+    uint32_t entrySize = Le32(header + 84);
+    if (entrySize < kGptEntryMinSize || !IsPowerOfTwo(entrySize)) {
+        LOG(WARNING) << "Invalid GPT entry size " << entrySize;
+        return Gpt::kInvalid;
+    }
+    uint64_t entriesSize = uint64_t(numEntries) * entrySize;
+    if (entriesLba < 2 || entriesLba > kMaxEntriesOffset / sectorSize ||
+        entriesSize > kMaxEntriesSize) {
+        LOG(WARNING) << "Unsupported GPT entry array of " << numEntries << " entries at LBA "
+                     << entriesLba;
+        return Gpt::kInvalid;
+    }
+
+    uint64_t offset = entriesLba * sectorSize;
+    raw->entries.resize(entriesSize);
+    if (offset + entriesSize <= raw->head.size()) {
+        std::copy_n(raw->head.begin() + offset, entriesSize, raw->entries.begin());
+    } else if (!read(raw->entries.data(), entriesSize, offset)) {
+        PLOG(WARNING) << "Failed to read GPT entries";
+        return Gpt::kInvalid;
+    }
+    if (Crc32(raw->entries.data(), raw->entries.size()) != Le32(header + 88)) {
+        LOG(WARNING) << "GPT entry array CRC mismatch";
+        return Gpt::kInvalid;
+    }
+
+    raw->entrySize = entrySize;
+    raw->crc = Crc32(header, headerSize, raw->crc);
+    raw->crc = Crc32(raw->entries.data(), raw->entries.size(), raw->crc);
+    return Gpt::kValid;
+}
+
+static status_t Load(const ReadFn& read, uint32_t sectorSize, RawTable* raw) {
+    if (sectorSize < kMbrSize || sectorSize > 4096 || !IsPowerOfTwo(sectorSize)) {
+        LOG(WARNING) << "Unsupported sector size " << sectorSize;
+        return -EINVAL;
+    }
+    raw->head.resize(kHeadSize);
+    if (!read(raw->head.data(), raw->head.size(), 0)) {
+        PLOG(WARNING) << "Failed to read partition table";
+        return -EIO;
+    }
+    const uint8_t* mbr = raw->head.data();
+    raw->crc = Crc32(mbr, kMbrSize);
+
+    Gpt gpt = LoadGpt(read, sectorSize, raw);
+    if (gpt == Gpt::kValid) {
+        raw->type = PartitionTable::Type::kGpt;
+        return OK;
+    }
+    // A damaged primary GPT may still have a good backup at the end of the disk
+    auto unknownOr = [gpt](PartitionTable::Type type) {
+        return gpt == Gpt::kInvalid ? PartitionTable::Type::kUnknown : type;
+    };
+
+    if (mbr[510] != 0x55 || mbr[511] != 0xAA) {
+        raw->type = unknownOr(PartitionTable::Type::kNone);
+        return OK;
+    }
+    bool deferred = false;
+    for (size_t i = 0; i < kMbrEntries; i++) {
+        const uint8_t* entry = mbr + kMbrEntriesOffset + i * kMbrEntrySize;
+        // Same test as the kernel: anything else is most likely the boot
+        // sector of a filesystem covering the whole disk
+        if (entry[0] != 0x00 && entry[0] != 0x80) {
+            raw->type = unknownOr(PartitionTable::Type::kNone);
+            return OK;
+        }
+        switch (entry[4]) {
+            case 0x05:  // Extended
+            case 0x0f:  // W95 Extended (LBA)
+            case 0x85:  // Linux extended
+            case 0xee:  // GPT protective
+                deferred = true;
+                break;
+        }
+    }
+    raw->type = deferred ? PartitionTable::Type::kUnknown : unknownOr(PartitionTable::Type::kMbr);
+    return OK;
+}
+
+static void Decode(const RawTable& raw, PartitionTable* table) {
+    table->type = raw.type;
+    table->crc = raw.crc;
+    table->partitions.clear();
+
+    if (raw.type == PartitionTable::Type::kMbr) {
+        for (size_t i = 0; i < kMbrEntries; i++) {
+            const uint8_t* entry = raw.head.data() + kMbrEntriesOffset + i * kMbrEntrySize;
+            if (entry[4] == 0 || Le32(entry + 12) == 0) continue;
+            PartitionTable::Partition partition;
+            partition.number = i + 1;
+            partition.mbrType = entry[4];
+            table->partitions.push_back(std::move(partition));
+        }
+    } else if (raw.type == PartitionTable::Type::kGpt) {
+        for (size_t i = 0; i < raw.entries.size() / raw.entrySize; i++) {
+            const uint8_t* entry = raw.entries.data() + i * raw.entrySize;
+            if (std::all_of(entry, entry + kGuidSize, [](uint8_t b) { return b == 0; })) continue;
+            PartitionTable::Partition partition;
+            partition.number = i + 1;
+            partition.typeGuid = FormatGuid(entry);
+            partition.partGuid = FormatGuid(entry + kGuidSize);
+            table->partitions.push_back(std::move(partition));
+        }
+    }
+}
+
+static status_t Read(const ReadFn& read, uint32_t sectorSize, PartitionTable* table) {
+    RawTable raw;
+    status_t res = Load(read, sectorSize, &raw);
+    if (res != OK) return res;
+    Decode(raw, table);
+    return OK;
+}
+
+static ReadFn FdReader(int fd) {
+    return [fd](uint8_t* buf, size_t len, uint64_t offset) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = TEMP_FAILURE_RETRY(pread64(fd, buf + done, len - done, offset + done));
+            if (n < 0) return false;
+            if (n == 0) break;
+            done += n;
+        }
+        memset(buf + done, 0, len - done);
+        return true;
+    };
+}
+
+static uint32_t GetSectorSize(int fd) {
+    int size;
+    if (ioctl(fd, BLKSSZGET, &size) == -1) {
+        PLOG(WARNING) << "Failed to get sector size; assuming 512";
+        return kMbrSize;
+    }
+    return size;
+}
+
+status_t ReadPartitionTable(int fd, PartitionTable* table) {
+    return Read(FdReader(fd), GetSectorSize(fd), table);
+}
+
+status_t ReadPartitionTable(const uint8_t* data, size_t size, uint32_t sectorSize,
+                            PartitionTable* table) {
+    return Read(
+            [data, size](uint8_t* buf, size_t len, uint64_t offset) {
+                size_t avail = offset < size ? std::min<uint64_t>(size - offset, len) : 0;
+                if (avail > 0) memcpy(buf, data + offset, avail);
+                memset(buf + avail, 0, len - avail);
+                return true;
+            },
+            sectorSize, table);
+}
+
+void ParseSgdiskOutput(const std::vector<std::string>& output, PartitionTable* table) {
+    for (const auto& line : output) {
+        auto split = android::base::Split(line, kSgdiskToken);
+        auto it = split.begin();
+        if (it == split.end()) continue;
+
+        if (*it == "DISK") {
+            if (++it == split.end()) continue;
+            if (*it == "mbr") {
+                table->type = PartitionTable::Type::kMbr;
+            } else if (*it == "gpt") {
+                table->type = PartitionTable::Type::kGpt;
+            } else {
+                LOG(WARNING) << "Invalid partition table " << *it;
+                continue;
+            }
+        } else if (*it == "PART") {
+            // Unusable entries still count, so that the whole device isn't tried
+            table->partitions.emplace_back();
+            auto& partition = table->partitions.back();
+            if (++it == split.end()) continue;
+            if (!android::base::ParseInt(*it, &partition.number)) {
+                LOG(WARNING) << "Invalid partition number " << *it;
+                continue;
+            }
+
+            if (table->type == PartitionTable::Type::kMbr) {
+                if (++it == split.end()) continue;
+                if (!android::base::ParseInt("0x" + *it, &partition.mbrType)) {
+                    LOG(WARNING) << "Invalid partition type " << *it;
+                    continue;
+                }
+            } else if (table->type == PartitionTable::Type::kGpt) {
+                if (++it == split.end()) continue;
+                partition.typeGuid = *it;
+                if (++it == split.end()) continue;
+                partition.partGuid = *it;
+            }
+        }
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_PARTITION_TABLE_H
+#define ANDROID_VOLD_PARTITION_TABLE_H
+
+#include <utils/Errors.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * In-process replacement for "sgdisk --android-dump" covering what
+ * Disk::readPartitions() needs: the type of each MBR partition, and the type
+ * and partition GUIDs of each GPT one, formatted the way sgdisk prints them.
+ *
+ * The table is untrusted input: both GPT CRCs are checked, every size and
+ * offset is bounds checked, and at most two reads are made, one of the start
+ * of the disk and one of a GPT entry array that doesn't fit in it. Anything
+ * this can't vouch for, like a damaged primary GPT with a good backup or
+ * logical MBR partitions, comes back as kUnknown for sgdisk to look at.
+ */
+struct PartitionTable {
+    enum class Type {
+        /* Possibly a table, but not one this reader handles */
+        kUnknown,
+        /* Definitely no table, e.g. a filesystem on the whole disk */
+        kNone,
+        kMbr,
+        kGpt,
+    };
+
+    struct Partition {
+        /* The kernel numbers the partition device minor(disk) + number */
+        int number = 0;
+        /* MBR partition type; 0 on GPT */
+        int mbrType = 0;
+        /* Upper case and dashed; empty on MBR */
+        std::string typeGuid;
+        std::string partGuid;
+    };
+
+    Type type = Type::kUnknown;
+    std::vector<Partition> partitions;
+    /* Changes whenever any byte the table was parsed from does */
+    uint32_t crc = 0;
+};
+
+/* Reads the table of the block device open on |fd| */
+status_t ReadPartitionTable(int fd, PartitionTable* table);
+
+/* Reads the table from an in-memory image of the start of a disk */
+status_t ReadPartitionTable(const uint8_t* data, size_t size, uint32_t sectorSize,
+                            PartitionTable* table);
+
+/*
+ * Turns the output of "sgdisk --android-dump" into the same form, for the
+ * tables left to sgdisk. Entries it can't parse are kept with number 0.
+ */
+void ParseSgdiskOutput(const std::vector<std::string>& output, PartitionTable* table);
+
+}  // namespace vold
+}  // namespace android
+
+#endif
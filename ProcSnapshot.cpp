@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ProcSnapshot.h"
+
+#include "DirentReader.h"
+#include "WorkStealingPool.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string_view>
+#include <unordered_set>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// How many pids a scan task takes at a time
+static constexpr size_t kScanBatchSize = 32;
+static constexpr size_t kMapsBufferSize = 64 * 1024;
+
+static std::mutex sLock;
+static std::shared_ptr<const ProcSnapshot> sLatest;
+
+static bool ReadLink(int dirFd, const char* name, std::string* target) {
+    char buf[PATH_MAX];
+    ssize_t len = readlinkat(dirFd, name, buf, sizeof(buf));
+    if (len <= 0) return false;
+    target->assign(buf, len);
+    return true;
+}
+
+const std::vector<std::string>& ProcSnapshot::Process::mappedFiles() const {
+    std::call_once(mMappedOnce, [this]() {
+        unique_fd fd(openAt("maps", O_RDONLY | O_CLOEXEC));
+        if (fd == -1) return;
+
+        // Read the whole file in one growing buffer, reused by the calling
+        // thread, and pick the paths out of it in place
+        static thread_local std::vector<char> buf(kMapsBufferSize);
+        size_t len = 0;
+        while (true) {
+            if (len == buf.size()) buf.resize(buf.size() * 2);
+            ssize_t n = TEMP_FAILURE_RETRY(read(fd, buf.data() + len, buf.size() - len));
+            if (n <= 0) break;
+            len += n;
+        }
+
+        std::unordered_set<std::string_view> seen;
+        const char* p = buf.data();
+        const char* end = p + len;
+        while (p < end) {
+            auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (eol == nullptr) eol = end;
+            auto slash = static_cast<const char*>(memchr(p, '/', eol - p));
+            if (slash != nullptr && seen.emplace(slash, eol - slash).second) {
+                mMappedFiles.emplace_back(slash, eol - slash);
+            }
+            p = eol + 1;
+        }
+    });
+    return mMappedFiles;
+}
+
+const std::vector<std::string>& ProcSnapshot::Process::openFiles() const {
+    std::call_once(mOpenOnce, [this]() {
+        unique_fd pidFd(openAt(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (pidFd == -1) return;
+
+        std::string target;
+        if (ReadLink(pidFd, "cwd", &target)) mOpenFiles.push_back(target);
+        if (ReadLink(pidFd, "root", &target)) mOpenFiles.push_back(target);
+
+        unique_fd fdDir(openat(pidFd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (fdDir == -1) {
+            // The process may have exited since we listed it
+            if (errno != ENOENT) PLOG(WARNING) << "Failed to open /proc/" << pid << "/fd";
+            return;
+        }
+        DirentReader reader(fdDir, 16 * 1024);
+        DirentReader::Entry entry;
+        while (reader.next(&entry)) {
+            if (entry.type != DT_LNK) continue;
+            if (ReadLink(fdDir, entry.name, &target)) mOpenFiles.push_back(target);
+        }
+    });
+    return mOpenFiles;
+}
+
+const std::vector<ProcSnapshot::Mount>& ProcSnapshot::Process::mounts() const {
+    std::call_once(mMountsOnce, [this]() {
+        unique_fd fd(openAt("mounts", O_RDONLY | O_CLOEXEC));
+        if (fd == -1) {
+            PLOG(WARNING) << "Failed to open /proc/" << pid << "/mounts";
+            return;
+        }
+        auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(fdopen(fd.get(), "r"), fclose);
+        if (!fp) return;
+        fd.release();
+
+        // getmntent() isn't safe to call from several threads at once
+        mntent entry;
+        char buf[PATH_MAX * 2 + 512];
+        while (getmntent_r(fp.get(), &entry, buf, sizeof(buf)) != nullptr) {
+            mMounts.push_back({entry.mnt_fsname, entry.mnt_dir});
+        }
+    });
+    return mMounts;
+}
+
+int ProcSnapshot::Process::openAt(const char* name, int flags) const {
+    std::string path = std::to_string(pid) + "/" + name;
+    return openat(mProcFd, path.c_str(), flags);
+}
+
+std::shared_ptr<const ProcSnapshot> ProcSnapshot::Get(std::chrono::milliseconds maxAge) {
+    std::lock_guard<std::mutex> lock(sLock);
+    if (sLatest && std::chrono::steady_clock::now() - sLatest->mTakenAt < maxAge) {
+        return sLatest;
+    }
+    sLatest.reset();
+
+    std::shared_ptr<ProcSnapshot> snapshot(new ProcSnapshot());
+    if (!snapshot->load()) return nullptr;
+    sLatest = snapshot;
+    return sLatest;
+}
+
+void ProcSnapshot::Invalidate() {
+    std::lock_guard<std::mutex> lock(sLock);
+    sLatest.reset();
+}
+
+const ProcSnapshot::Process* ProcSnapshot::find(pid_t pid) const {
+    auto it = std::lower_bound(mProcesses.begin(), mProcesses.end(), pid,
+                               [](const auto& process, pid_t pid) { return process->pid < pid; });
+    return it != mProcesses.end() && (*it)->pid == pid ? it->get() : nullptr;
+}
+
+std::vector<pid_t> ProcSnapshot::filter(const std::function<bool(const Process&)>& match,
+                                        bool firstOnly) const {
+    // One flag per process, each written by a single task
+    std::vector<char> matches(mProcesses.size());
+    std::atomic<bool> done = false;
+    WorkStealingPool pool;
+    for (size_t start = 0; start < mProcesses.size(); start += kScanBatchSize) {
+        size_t end = std::min(start + kScanBatchSize, mProcesses.size());
+        pool.submit([&, start, end]() {
+            for (size_t i = start; i < end && !done.load(std::memory_order_relaxed); i++) {
+                if (!match(*mProcesses[i])) continue;
+                matches[i] = true;
+                if (firstOnly) done = true;
+            }
+        });
+    }
+    pool.wait();
+
+    std::vector<pid_t> pids;
+    for (size_t i = 0; i < mProcesses.size(); i++) {
+        if (matches[i]) pids.push_back(mProcesses[i]->pid);
+    }
+    return pids;
+}
+
+bool ProcSnapshot::load() {
+    mTakenAt = std::chrono::steady_clock::now();
+    mProcFd.reset(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (mProcFd == -1) {
+        PLOG(ERROR) << "Failed to open proc";
+        return false;
+    }
+
+    std::vector<pid_t> pids;
+    DirentReader reader(mProcFd);
+    DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        // We only care about valid PIDs
+        pid_t pid;
+        if (entry.type != DT_DIR) continue;
+        if (!android::base::ParseInt(entry.name, &pid)) continue;
+        pids.push_back(pid);
+    }
+    std::sort(pids.begin(), pids.end());
+    for (pid_t pid : pids) mProcesses.emplace_back(new Process(mProcFd, pid));
+
+    // One flag per process, each written by a single task
+    std::vector<char> alive(mProcesses.size());
+    WorkStealingPool pool;
+    for (size_t start = 0; start < mProcesses.size(); start += kScanBatchSize) {
+        size_t end = std::min(start + kScanBatchSize, mProcesses.size());
+        pool.submit([&, start, end]() {
+            for (size_t i = start; i < end; i++) {
+                Process& process = *mProcesses[i];
+                unique_fd pidFd(process.openAt(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+                struct stat sb;
+                if (pidFd == -1 || fstat(pidFd, &sb) != 0) continue;
+                process.uid = sb.st_uid;
+
+                // Kernel threads have no exe; anything else missing means
+                // the process exited under us
+                if (fstatat(pidFd, "ns/mnt", &sb, 0) == 0) process.mountNs = sb.st_ino;
+                ReadLink(pidFd, "exe", &process.exe);
+                unique_fd commFd(openat(pidFd, "comm", O_RDONLY | O_CLOEXEC));
+                if (commFd == -1 || !android::base::ReadFdToString(commFd, &process.comm)) {
+                    continue;
+                }
+                process.comm = android::base::Trim(process.comm);
+                alive[i] = true;
+            }
+        });
+    }
+    pool.wait();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < mProcesses.size(); i++) {
+        if (alive[i]) mProcesses[kept++] = std::move(mProcesses[i]);
+    }
+    mProcesses.resize(kept);
+    return true;
+}
+
+}  // namespace vold
+}  // namespace android
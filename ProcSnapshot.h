@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_PROC_SNAPSHOT_H
+#define ANDROID_VOLD_PROC_SNAPSHOT_H
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * One pass over /proc shared by the process scanners: the remount flows in
+ * VolumeManager and the kill helpers in Process.cpp.
+ *
+ * The cheap fields (uid, mount namespace, exe and comm) are read for every
+ * process in parallel when the snapshot is taken. The expensive ones (mapped
+ * files, open files and mounts) are read the first time they are asked for,
+ * once per process, and kept for anyone else sharing the snapshot.
+ *
+ * Get() hands out the previous snapshot while it is younger than |maxAge|,
+ * so flows that run several scans back to back only walk /proc once.
+ * Anything that changes the set of processes, like sending a signal, should
+ * call Invalidate() so the next caller sees the result. A process started
+ * inside the window is missed; callers that poll for a condition should ask
+ * for a zero |maxAge|.
+ */
+class ProcSnapshot {
+  public:
+    struct Mount {
+        std::string fsname;
+        std::string dir;
+    };
+
+    class Process {
+      public:
+        pid_t pid;
+        uid_t uid;
+        /* Inode of ns/mnt; processes share a namespace iff these match */
+        ino_t mountNs;
+        std::string exe;
+        std::string comm;
+
+        /* Distinct files mapped into the process */
+        const std::vector<std::string>& mappedFiles() const;
+        /* Targets of cwd, root and every fd */
+        const std::vector<std::string>& openFiles() const;
+        /* Entries of the process' mounts */
+        const std::vector<Mount>& mounts() const;
+
+        /* openat() relative to /proc/<pid>; -1 with errno set on failure */
+        int openAt(const char* name, int flags) const;
+
+      private:
+        friend class ProcSnapshot;
+        Process(int procFd, pid_t pid) : pid(pid), uid(0), mountNs(0), mProcFd(procFd) {}
+
+        int mProcFd;
+        mutable std::once_flag mMappedOnce;
+        mutable std::vector<std::string> mMappedFiles;
+        mutable std::once_flag mOpenOnce;
+        mutable std::vector<std::string> mOpenFiles;
+        mutable std::once_flag mMountsOnce;
+        mutable std::vector<Mount> mMounts;
+
+        DISALLOW_COPY_AND_ASSIGN(Process);
+    };
+
+    /* Long enough to cover a remount or unmount flow, short enough to stay accurate */
+    static constexpr std::chrono::milliseconds kDefaultMaxAge{500};
+
+    /* Returns nullptr if /proc couldn't be read */
+    static std::shared_ptr<const ProcSnapshot> Get(
+            std::chrono::milliseconds maxAge = kDefaultMaxAge);
+    static void Invalidate();
+
+    /* Sorted by pid */
+    const std::vector<std::unique_ptr<Process>>& processes() const { return mProcesses; }
+    const Process* find(pid_t pid) const;
+
+    /*
+     * Calls |match| on every process in parallel and returns the pids it
+     * accepted, in order. With |firstOnly|, stops once one is found.
+     */
+    std::vector<pid_t> filter(const std::function<bool(const Process&)>& match,
+                              bool firstOnly = false) const;
+
+  private:
+    ProcSnapshot() = default;
+    bool load();
+
+    android::base::unique_fd mProcFd;
+    std::chrono::steady_clock::time_point mTakenAt;
+    std::vector<std::unique_ptr<Process>> mProcesses;
+
+    DISALLOW_COPY_AND_ASSIGN(ProcSnapshot);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -26,18 +26,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
-#include <mntent.h>
-#include <unordered_set>
+#include <string_view>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 
+#include "ProcSnapshot.h"
 #include "Process.h"
 #include "Utils.h"
 
@@ -46,146 +50,123 @@ using android::base::StringPrintf;
 namespace android {
 namespace vold {
 
-static bool checkMaps(const std::string& path, const std::string& prefix) {
-    bool found = false;
-    auto file = std::unique_ptr<FILE, decltype(&fclose)>{fopen(path.c_str(), "re"), fclose};
-    if (!file) {
-        return false;
-    }
+static bool HasPrefix(std::string_view s, const std::string& prefix) {
+    return s.size() >= prefix.size() && memcmp(s.data(), prefix.data(), prefix.size()) == 0;
+}
 
-    char* buf = nullptr;
-    size_t len = 0;
-    while (getline(&buf, &len, file.get()) != -1) {
-        std::string line(buf);
-        std::string::size_type pos = line.find('/');
-        if (pos != std::string::npos) {
-            line = line.substr(pos);
-            if (android::base::StartsWith(line, prefix)) {
-                LOG(WARNING) << "Found map " << path << " referencing " << line;
-                found = true;
-                break;
-            }
+// Whether |process| maps, has open, or runs from a file under |prefix|
+static bool hasOpenFiles(const ProcSnapshot::Process& process, const std::string& prefix) {
+    if (HasPrefix(process.exe, prefix)) {
+        LOG(WARNING) << "Found exe of pid " << process.pid << " referencing " << process.exe;
+        return true;
+    }
+    for (const auto& file : process.mappedFiles()) {
+        if (HasPrefix(file, prefix)) {
+            LOG(WARNING) << "Found map of pid " << process.pid << " referencing " << file;
+            return true;
         }
     }
-    free(buf);
-
-    return found;
-}
-
-static bool checkSymlink(const std::string& path, const std::string& prefix) {
-    std::string res;
-    if (android::base::Readlink(path, &res)) {
-        if (android::base::StartsWith(res, prefix)) {
-            LOG(WARNING) << "Found symlink " << path << " referencing " << res;
+    for (const auto& file : process.openFiles()) {
+        if (HasPrefix(file, prefix)) {
+            LOG(WARNING) << "Found open file of pid " << process.pid << " referencing " << file;
             return true;
         }
     }
     return false;
 }
 
-// TODO: Refactor the code with KillProcessesWithOpenFiles().
-int KillProcessesWithTmpfsMounts(const std::string& prefix, int signal) {
-    std::unordered_set<pid_t> pids;
+// Every process with maps, cwd, root, exe or fds under |prefix|, leaving out
+// the FUSE daemon unless |includeFuseDaemon|. With |firstOnly|, stops as soon
+// as one is found.
+static std::vector<pid_t> findProcessesWithOpenFiles(const ProcSnapshot& snapshot,
+                                                     const std::string& prefix,
+                                                     bool includeFuseDaemon, bool firstOnly) {
+    return snapshot.filter(
+            [&](const ProcSnapshot::Process& process) {
+                if (!hasOpenFiles(process, prefix)) return false;
+                if (!includeFuseDaemon && IsFuseDaemon(process.pid)) {
+                    LOG(WARNING) << "Found FUSE daemon with open file. Skipping...";
+                    return false;
+                }
+                return true;
+            },
+            firstOnly);
+}
+
+bool HasProcessesWithOpenFiles(const std::string& prefix, bool includeFuseDaemon) {
+    // Meant for polling, so always look again
+    auto snapshot = ProcSnapshot::Get(std::chrono::milliseconds::zero());
+    return snapshot &&
+           !findProcessesWithOpenFiles(*snapshot, prefix, includeFuseDaemon, true).empty();
+}
 
-    auto proc_d = std::unique_ptr<DIR, int (*)(DIR*)>(opendir("/proc"), closedir);
-    if (!proc_d) {
-        PLOG(ERROR) << "Failed to open proc";
+// Signals |pid| through a pidfd where the kernel has them, so a recycled pid
+// can't be hit, and keeps the pidfd in |pidfds| for the caller to wait on
+static int signalProcess(pid_t pid, int signal, std::vector<android::base::unique_fd>* pidfds) {
+    android::base::unique_fd pidfd(syscall(__NR_pidfd_open, pid, 0));
+    if (pidfd == -1) {
+        return kill(pid, signal);
+    }
+    if (syscall(__NR_pidfd_send_signal, pidfd.get(), signal, nullptr, 0) < 0) {
         return -1;
     }
+    if (pidfds != nullptr) pidfds->push_back(std::move(pidfd));
+    return 0;
+}
 
-    struct dirent* proc_de;
-    while ((proc_de = readdir(proc_d.get())) != nullptr) {
-        // We only care about valid PIDs
-        pid_t pid;
-        if (proc_de->d_type != DT_DIR) continue;
-        if (!android::base::ParseInt(proc_de->d_name, &pid)) continue;
-
-        // Look for references to prefix
-        std::string mounts_file(StringPrintf("/proc/%d/mounts", pid));
-        auto fp = std::unique_ptr<FILE, int (*)(FILE*)>(
-                setmntent(mounts_file.c_str(), "r"), endmntent);
-        if (!fp) {
-            PLOG(WARNING) << "Failed to open " << mounts_file;
-            continue;
-        }
-
+static std::vector<pid_t> findProcessesWithTmpfsMounts(const ProcSnapshot& snapshot,
+                                                       const std::string& prefix) {
+    return snapshot.filter([&](const ProcSnapshot::Process& process) {
         // Check if obb directory is mounted, and get all packages of mounted app data directory.
-        mntent* mentry;
-        while ((mentry = getmntent(fp.get())) != nullptr) {
-            if (mentry->mnt_fsname != nullptr && strncmp(mentry->mnt_fsname, "tmpfs", 5) == 0
-                    && android::base::StartsWith(mentry->mnt_dir, prefix)) {
-                pids.insert(pid);
-                break;
+        for (const auto& mount : process.mounts()) {
+            if (android::base::StartsWith(mount.fsname, "tmpfs") &&
+                android::base::StartsWith(mount.dir, prefix)) {
+                return true;
             }
         }
+        return false;
+    });
+}
+
+bool HasProcessesWithTmpfsMounts(const std::string& prefix) {
+    // Meant for polling, so always look again
+    auto snapshot = ProcSnapshot::Get(std::chrono::milliseconds::zero());
+    return snapshot && !findProcessesWithTmpfsMounts(*snapshot, prefix).empty();
+}
+
+int KillProcessesWithTmpfsMounts(const std::string& prefix, int signal,
+                                 std::vector<android::base::unique_fd>* pidfds) {
+    auto snapshot = ProcSnapshot::Get();
+    if (!snapshot) {
+        return -1;
     }
-    if (signal != 0) {
+    auto pids = findProcessesWithTmpfsMounts(*snapshot, prefix);
+    if (signal != 0 && !pids.empty()) {
         for (const auto& pid : pids) {
             LOG(WARNING) << "Killing pid "<< pid << " with signal " << strsignal(signal) <<
                     " because it has a mount with prefix " << prefix;
-            kill(pid, signal);
+            signalProcess(pid, signal, pidfds);
         }
+        ProcSnapshot::Invalidate();
     }
     return pids.size();
 }
 
-int KillProcessesWithOpenFiles(const std::string& prefix, int signal, bool killFuseDaemon) {
-    std::unordered_set<pid_t> pids;
-
-    auto proc_d = std::unique_ptr<DIR, int (*)(DIR*)>(opendir("/proc"), closedir);
-    if (!proc_d) {
-        PLOG(ERROR) << "Failed to open proc";
+int KillProcessesWithOpenFiles(const std::string& prefix, int signal, bool killFuseDaemon,
+                               std::vector<android::base::unique_fd>* pidfds) {
+    auto snapshot = ProcSnapshot::Get();
+    if (!snapshot) {
         return -1;
     }
+    auto pids = findProcessesWithOpenFiles(*snapshot, prefix, killFuseDaemon, false);
 
-    struct dirent* proc_de;
-    while ((proc_de = readdir(proc_d.get())) != nullptr) {
-        // We only care about valid PIDs
-        pid_t pid;
-        if (proc_de->d_type != DT_DIR) continue;
-        if (!android::base::ParseInt(proc_de->d_name, &pid)) continue;
-
-        // Look for references to prefix
-        bool found = false;
-        auto path = StringPrintf("/proc/%d", pid);
-        found |= checkMaps(path + "/maps", prefix);
-        found |= checkSymlink(path + "/cwd", prefix);
-        found |= checkSymlink(path + "/root", prefix);
-        found |= checkSymlink(path + "/exe", prefix);
-
-        auto fd_path = path + "/fd";
-        auto fd_d = std::unique_ptr<DIR, int (*)(DIR*)>(opendir(fd_path.c_str()), closedir);
-        if (!fd_d) {
-            PLOG(WARNING) << "Failed to open " << fd_path;
-        } else {
-            struct dirent* fd_de;
-            while ((fd_de = readdir(fd_d.get())) != nullptr) {
-                if (fd_de->d_type != DT_LNK) continue;
-                found |= checkSymlink(fd_path + "/" + fd_de->d_name, prefix);
-            }
-        }
-
-        if (found) {
-            if (!IsFuseDaemon(pid) || killFuseDaemon) {
-                pids.insert(pid);
-            } else {
-                LOG(WARNING) << "Found FUSE daemon with open file. Skipping...";
-            }
-        }
-    }
     int totalKilledPids = pids.size();
     if (signal != 0) {
         for (const auto& pid : pids) {
-            std::string comm;
-            android::base::ReadFileToString(StringPrintf("/proc/%d/comm", pid), &comm);
-            comm = android::base::Trim(comm);
-
-            std::string exe;
-            android::base::Readlink(StringPrintf("/proc/%d/exe", pid), &exe);
-
-            LOG(WARNING) << "Sending " << strsignal(signal) << " to pid " << pid << " (" << comm
-                         << ", " << exe << ")";
-            if (kill(pid, signal) < 0) {
+            const auto* process = snapshot->find(pid);
+            LOG(WARNING) << "Sending " << strsignal(signal) << " to pid " << pid << " ("
+                         << process->comm << ", " << process->exe << ")";
+            if (signalProcess(pid, signal, pidfds) < 0) {
                 if (errno == ESRCH) {
                     totalKilledPids--;
                     LOG(WARNING) << "The target pid " << pid << " was already killed";
@@ -194,6 +175,7 @@ int KillProcessesWithOpenFiles(const std::string& prefix, int signal, bool killF
                 LOG(ERROR) << "Unable to send signal " << strsignal(signal) << " to pid " << pid;
             }
         }
+        if (!pids.empty()) ProcSnapshot::Invalidate();
     }
     return totalKilledPids;
 }
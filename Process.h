@@ -17,11 +17,30 @@
 #ifndef _PROCESS_H
 #define _PROCESS_H
 
+#include <android-base/unique_fd.h>
+
+#include <string>
+#include <vector>
+
 namespace android {
 namespace vold {
 
-int KillProcessesWithOpenFiles(const std::string& path, int signal, bool killFuseDaemon = true);
-int KillProcessesWithTmpfsMounts(const std::string& path, int signal);
+/*
+ * Both return how many processes were found. When |pidfds| is given, a pidfd
+ * for every process that was signalled is appended to it so the caller can
+ * wait for them to exit.
+ */
+int KillProcessesWithOpenFiles(const std::string& path, int signal, bool killFuseDaemon = true,
+                               std::vector<android::base::unique_fd>* pidfds = nullptr);
+int KillProcessesWithTmpfsMounts(const std::string& path, int signal,
+                                 std::vector<android::base::unique_fd>* pidfds = nullptr);
+
+/*
+ * Whether any process has files under |path| open, or a tmpfs mounted under
+ * it. Unlike the above, these always take a fresh look at /proc.
+ */
+bool HasProcessesWithOpenFiles(const std::string& path, bool includeFuseDaemon = true);
+bool HasProcessesWithTmpfsMounts(const std::string& path);
 
 }  // namespace vold
 }  // namespace android
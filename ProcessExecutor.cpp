@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ProcessExecutor.h"
+#include "Utils.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace std::chrono_literals;
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// How long a timed out command gets to exit after SIGTERM before SIGKILL
+static constexpr std::chrono::milliseconds kTerminateGracePeriod = 2s;
+// How often children are polled with waitpid() when pidfds are unavailable
+static constexpr int kReapPollMs = 50;
+
+// Epoll keys: 0 is the wakeup eventfd, otherwise (id << 1) | isPidfd
+static constexpr uint64_t kWakeKey = 0;
+
+ProcessExecutor* ProcessExecutor::sInstance = nullptr;
+
+ProcessExecutor* ProcessExecutor::Instance() {
+    static std::once_flag once;
+    std::call_once(once, [] { sInstance = new ProcessExecutor(); });
+    return sInstance;
+}
+
+ProcessExecutor::ProcessExecutor()
+    : mEpollFd(epoll_create1(EPOLL_CLOEXEC)), mWakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    PCHECK(mEpollFd != -1 && mWakeFd != -1) << "Failed to set up ProcessExecutor";
+    struct epoll_event ev = {.events = EPOLLIN, .data = {.u64 = kWakeKey}};
+    PCHECK(epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) == 0);
+
+    mLoopThread = std::thread(&ProcessExecutor::runLoop, this);
+    mCallbackThread = std::thread(&ProcessExecutor::runCallbacks, this);
+}
+
+void ProcessExecutor::submit(Command command, Callback callback) {
+    Result failed;
+    unique_fd outRead, outWrite;
+    if (!android::base::Pipe(&outRead, &outWrite)) {
+        PLOG(ERROR) << "Pipe in ProcessExecutor";
+        failed.status = -errno;
+        post(std::move(callback), std::move(failed));
+        return;
+    }
+
+    Child child;
+    status_t res = SpawnProcess(command.args, command.context, outWrite.get(), &child.pid);
+    if (res != OK) {
+        failed.status = res;
+        post(std::move(callback), std::move(failed));
+        return;
+    }
+    outWrite.reset();
+    fcntl(outRead, F_SETFL, O_NONBLOCK);
+
+    child.name = command.args[0];
+    child.pidfd.reset(syscall(__NR_pidfd_open, child.pid, 0));
+    child.out = std::move(outRead);
+    child.callback = std::move(callback);
+    child.deadline = command.timeout.count() > 0
+                             ? std::chrono::steady_clock::now() + command.timeout
+                             : std::chrono::steady_clock::time_point::max();
+
+    std::lock_guard<std::mutex> lock(mLock);
+    uint64_t id = mNextId++;
+    struct epoll_event ev = {.events = EPOLLIN, .data = {.u64 = id << 1}};
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, child.out, &ev) != 0) {
+        PLOG(WARNING) << "Failed to watch output of " << child.name;
+        child.out.reset();
+    }
+    ev.data.u64 = (id << 1) | 1;
+    if (child.pidfd != -1 && epoll_ctl(mEpollFd, EPOLL_CTL_ADD, child.pidfd, &ev) != 0) {
+        PLOG(WARNING) << "Failed to watch pidfd of " << child.name;
+        child.pidfd.reset();
+    }
+    mChildren.emplace(id, std::move(child));
+
+    // The loop may need to wake up earlier for this deadline
+    uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(mWakeFd, &one, sizeof(one)));
+}
+
+std::future<ProcessExecutor::Result> ProcessExecutor::submit(Command command) {
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto future = promise->get_future();
+    submit(std::move(command), [promise](Result result) { promise->set_value(std::move(result)); });
+    return future;
+}
+
+void ProcessExecutor::post(Callback callback, Result result) {
+    {
+        std::lock_guard<std::mutex> lock(mCallbackLock);
+        mCallbacks.emplace_back(std::move(callback), std::move(result));
+    }
+    mCallbackReady.notify_one();
+}
+
+void ProcessExecutor::runCallbacks() {
+    while (true) {
+        std::pair<Callback, Result> next;
+        {
+            std::unique_lock<std::mutex> lock(mCallbackLock);
+            mCallbackReady.wait(lock, [this] { return !mCallbacks.empty(); });
+            next = std::move(mCallbacks.front());
+            mCallbacks.pop_front();
+        }
+        if (next.first) next.first(std::move(next.second));
+    }
+}
+
+void ProcessExecutor::readOutput(Child& child, bool drain) {
+    if (child.out == -1) return;
+
+    char buf[4096];
+    while (true) {
+        ssize_t n = read(child.out, buf, sizeof(buf));
+        if (n > 0) {
+            child.partial.append(buf, n);
+            size_t start = 0, end;
+            while ((end = child.partial.find('\n', start)) != std::string::npos) {
+                std::string line = child.partial.substr(start, end + 1 - start);
+                LOG(DEBUG) << line;
+                child.result.output.push_back(std::move(line));
+                start = end + 1;
+            }
+            child.partial.erase(0, start);
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN && !drain) return;
+        // EOF, an error, or nothing left once the child is gone; a grandchild
+        // holding the pipe open must not keep us waiting
+        break;
+    }
+    if (!child.partial.empty()) {
+        LOG(DEBUG) << child.partial;
+        child.result.output.push_back(std::move(child.partial));
+        child.partial.clear();
+    }
+    child.out.reset();
+}
+
+bool ProcessExecutor::reap(Child& child, int flags) {
+    int status;
+    pid_t res = TEMP_FAILURE_RETRY(waitpid(child.pid, &status, flags));
+    if (res == 0) return false;
+    if (res == -1) {
+        PLOG(ERROR) << "waitpid in ProcessExecutor";
+        child.result.status = -errno;
+    } else if (child.terminated) {
+        child.result.status = ETIMEDOUT;
+    } else if (!WIFEXITED(status)) {
+        LOG(ERROR) << child.name << " did not exit normally, status: " << status;
+        child.result.status = -ECHILD;
+    } else if (WEXITSTATUS(status)) {
+        LOG(ERROR) << child.name << " exited with code: " << WEXITSTATUS(status);
+        child.result.status = WEXITSTATUS(status);
+    }
+    return true;
+}
+
+void ProcessExecutor::finish(uint64_t id) {
+    auto it = mChildren.find(id);
+    Child& child = it->second;
+    readOutput(child, true);
+    post(std::move(child.callback), std::move(child.result));
+    // Closing the fds also drops them from the epoll set
+    mChildren.erase(it);
+}
+
+int ProcessExecutor::nextTimeoutMs() {
+    auto now = std::chrono::steady_clock::now();
+    int timeout = -1;
+    for (const auto& [id, child] : mChildren) {
+        if (child.pidfd == -1) timeout = kReapPollMs;
+        if (child.deadline == std::chrono::steady_clock::time_point::max()) continue;
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(child.deadline - now);
+        int ms = std::max<int64_t>(left.count(), 0);
+        timeout = (timeout == -1) ? ms : std::min(timeout, ms);
+    }
+    return timeout;
+}
+
+void ProcessExecutor::runLoop() {
+    struct epoll_event events[16];
+    while (true) {
+        int timeout;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            timeout = nextTimeoutMs();
+        }
+        int n = epoll_wait(mEpollFd, events, std::size(events), timeout);
+        if (n == -1) {
+            if (errno != EINTR) PLOG(ERROR) << "epoll_wait in ProcessExecutor";
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mLock);
+        for (int i = 0; i < n; i++) {
+            uint64_t key = events[i].data.u64;
+            if (key == kWakeKey) {
+                uint64_t count;
+                TEMP_FAILURE_RETRY(read(mWakeFd, &count, sizeof(count)));
+                continue;
+            }
+            auto it = mChildren.find(key >> 1);
+            if (it == mChildren.end()) continue;
+            if (key & 1) {
+                if (reap(it->second, 0)) finish(it->first);
+            } else {
+                readOutput(it->second, false);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = mChildren.begin(); it != mChildren.end();) {
+            uint64_t id = it->first;
+            Child& child = (it++)->second;
+            if (child.pidfd == -1 && reap(child, WNOHANG)) {
+                finish(id);
+            } else if (now >= child.deadline) {
+                if (!child.terminated) {
+                    LOG(ERROR) << child.name << " timed out";
+                    kill(child.pid, SIGTERM);
+                    child.terminated = true;
+                    child.deadline = now + kTerminateGracePeriod;
+                } else {
+                    kill(child.pid, SIGKILL);
+                    child.deadline = std::chrono::steady_clock::time_point::max();
+                }
+            }
+        }
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_PROCESS_EXECUTOR_H
+#define ANDROID_VOLD_PROCESS_EXECUTOR_H
+
+#include <android-base/macros.h>
+#include <android-base/unique_fd.h>
+#include <utils/Errors.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * Runs external tools (blkid, fsck, sgdisk, ...) concurrently without tying
+ * up the calling thread.
+ *
+ * Every command is spawned right away; a single thread then watches all of
+ * them with epoll, reading their stdout as it arrives and noticing their exit
+ * through a pidfd. Kernels without pidfds fall back to polling waitpid().
+ * Completions are delivered in order on a separate thread, so a slow callback
+ * never delays the reaping or timeouts of other commands.
+ */
+class ProcessExecutor {
+  public:
+    struct Command {
+        std::vector<std::string> args;
+        /* SELinux context to exec in, as for ForkExecvp() */
+        char* context = nullptr;
+        /* SIGTERM, then SIGKILL, once this passes; zero means no limit */
+        std::chrono::milliseconds timeout{0};
+    };
+
+    struct Result {
+        /* As ForkExecvp(): exit code or negative errno, ETIMEDOUT on timeout */
+        status_t status = OK;
+        /* Lines of stdout, each with its trailing newline */
+        std::vector<std::string> output;
+    };
+
+    using Callback = std::function<void(Result)>;
+
+    static ProcessExecutor* Instance();
+
+    /* Starts |command| and calls |callback| with its result when it is done */
+    void submit(Command command, Callback callback);
+    /* Starts |command| and returns its eventual result; don't wait on it from a callback */
+    std::future<Result> submit(Command command);
+
+  private:
+    struct Child {
+        pid_t pid;
+        std::string name;
+        android::base::unique_fd pidfd;
+        android::base::unique_fd out;
+        std::string partial;
+        Result result;
+        Callback callback;
+        std::chrono::steady_clock::time_point deadline;
+        bool terminated = false;
+    };
+
+    ProcessExecutor();
+
+    void post(Callback callback, Result result);
+    void runLoop();
+    void runCallbacks();
+    void readOutput(Child& child, bool drain);
+    bool reap(Child& child, int flags);
+    void finish(uint64_t id);
+    int nextTimeoutMs();
+
+    android::base::unique_fd mEpollFd;
+    android::base::unique_fd mWakeFd;
+
+    std::mutex mLock;
+    uint64_t mNextId = 1;
+    std::map<uint64_t, Child> mChildren;
+
+    std::mutex mCallbackLock;
+    std::condition_variable mCallbackReady;
+    std::deque<std::pair<Callback, Result>> mCallbacks;
+
+    std::thread mLoopThread;
+    std::thread mCallbackThread;
+
+    static ProcessExecutor* sInstance;
+
+    DISALLOW_COPY_AND_ASSIGN(ProcessExecutor);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SystemCapabilities.h"
+#include "Utils.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+static const char* kProcDevices = "/proc/devices";
+static const char* kProcFilesystems = "/proc/filesystems";
+
+static std::atomic<const SystemCapabilities*> sCurrent = nullptr;
+// Guards building a snapshot, and owns every one ever published
+static std::mutex sLock;
+static std::vector<std::unique_ptr<const SystemCapabilities>> sSnapshots;
+
+// Lines look like "nodev\tsysfs" or "\text4"
+static std::unordered_set<std::string> ReadFilesystems() {
+    std::unordered_set<std::string> filesystems;
+    std::string supported;
+    if (!android::base::ReadFileToString(kProcFilesystems, &supported)) {
+        PLOG(ERROR) << "Failed to read supported filesystems";
+        return filesystems;
+    }
+    for (const auto& line : android::base::Split(supported, "\n")) {
+        auto pos = line.rfind('\t');
+        std::string name = android::base::Trim(pos == std::string::npos ? line : line.substr(pos));
+        if (!name.empty()) filesystems.insert(name);
+    }
+    return filesystems;
+}
+
+static unsigned int GetMajorBlockVirtioBlk() {
+    std::string devices;
+    if (!android::base::ReadFileToString(kProcDevices, &devices)) {
+        PLOG(ERROR) << "Unable to open /proc/devices";
+        return 0;
+    }
+
+    bool blockSection = false;
+    for (auto line : android::base::Split(devices, "\n")) {
+        if (line == "Block devices:") {
+            blockSection = true;
+        } else if (line == "Character devices:") {
+            blockSection = false;
+        } else if (blockSection) {
+            auto tokens = android::base::Split(line, " ");
+            if (tokens.size() == 2 && tokens[1] == "virtblk") {
+                return std::stoul(tokens[0]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static bool IsPropertySet(const char* name, bool& value) {
+    if (base::GetProperty(name, "") == "") return false;
+
+    value = base::GetBoolProperty(name, false);
+    LOG(INFO) << "fuse-bpf is " << (value ? "enabled" : "disabled") << " because of property "
+              << name;
+    return true;
+}
+
+static bool GetFuseBpfEnabled() {
+    // This logic is reproduced in packages/providers/MediaProvider/jni/FuseDaemon.cpp
+    // so changes made here must be reflected there
+    bool enabled = false;
+
+    if (IsPropertySet("ro.fuse.bpf.is_running", enabled)) return enabled;
+
+    if (!IsPropertySet("persist.sys.fuse.bpf.override", enabled) &&
+        !IsPropertySet("ro.fuse.bpf.enabled", enabled)) {
+        // If the kernel has fuse-bpf, /sys/fs/fuse/features/fuse_bpf will exist and have the
+        // contents 'supported\n' - see fs/fuse/inode.c in the kernel source
+        std::string contents;
+        const char* filename = "/sys/fs/fuse/features/fuse_bpf";
+        if (!base::ReadFileToString(filename, &contents)) {
+            LOG(INFO) << "fuse-bpf is disabled because " << filename << " cannot be read";
+            enabled = false;
+        } else if (contents == "supported\n") {
+            LOG(INFO) << "fuse-bpf is enabled because " << filename << " reads 'supported'";
+            enabled = true;
+        } else {
+            LOG(INFO) << "fuse-bpf is disabled because " << filename
+                      << " does not read 'supported'";
+            enabled = false;
+        }
+    }
+    return enabled;
+}
+
+SystemCapabilities::SystemCapabilities()
+    : mFilesystems(ReadFilesystems()),
+      mFuseBpfEnabled(GetFuseBpfEnabled()),
+      mVirtioBlkMajor(GetMajorBlockVirtioBlk()) {
+    mSdcardfsUsed = isFilesystemSupported("sdcardfs") &&
+                    base::GetBoolProperty(kExternalStorageSdcardfs, true);
+}
+
+const SystemCapabilities& SystemCapabilities::Get() {
+    const SystemCapabilities* current = sCurrent.load(std::memory_order_acquire);
+    if (current != nullptr) return *current;
+
+    std::lock_guard<std::mutex> lock(sLock);
+    current = sCurrent.load(std::memory_order_relaxed);
+    if (current == nullptr) {
+        sSnapshots.emplace_back(new SystemCapabilities());
+        current = sSnapshots.back().get();
+        sCurrent.store(current, std::memory_order_release);
+    }
+    return *current;
+}
+
+void SystemCapabilities::Refresh() {
+    std::lock_guard<std::mutex> lock(sLock);
+    sSnapshots.emplace_back(new SystemCapabilities());
+    sCurrent.store(sSnapshots.back().get(), std::memory_order_release);
+}
+
+}  // namespace vold
+}  // namespace android
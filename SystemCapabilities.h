@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_SYSTEM_CAPABILITIES_H
+#define ANDROID_VOLD_SYSTEM_CAPABILITIES_H
+
+#include <android-base/macros.h>
+
+#include <string>
+#include <unordered_set>
+
+namespace android {
+namespace vold {
+
+/*
+ * What the kernel and build support, as far as vold cares: the filesystems in
+ * /proc/filesystems, whether sdcardfs and fuse-bpf are in use, and the major
+ * the kernel picked for virtio-blk.
+ *
+ * These are consulted for every app directory vold prepares, so they are
+ * read once into an immutable snapshot. Get() is a single atomic load;
+ * Refresh() builds a new snapshot and publishes it for later callers. Old
+ * snapshots are kept alive, as a reader may still hold one.
+ */
+class SystemCapabilities {
+  public:
+    static const SystemCapabilities& Get();
+    /* Re-reads everything, eg after kernel modules were loaded */
+    static void Refresh();
+
+    bool isFilesystemSupported(const std::string& fsType) const {
+        return mFilesystems.count(fsType) != 0;
+    }
+    bool isSdcardfsUsed() const { return mSdcardfsUsed; }
+    bool isFuseBpfEnabled() const { return mFuseBpfEnabled; }
+    /* Zero when there is no virtio-blk driver */
+    unsigned int virtioBlkMajor() const { return mVirtioBlkMajor; }
+
+  private:
+    SystemCapabilities();
+
+    std::unordered_set<std::string> mFilesystems;
+    bool mSdcardfsUsed;
+    bool mFuseBpfEnabled;
+    unsigned int mVirtioBlkMajor;
+
+    DISALLOW_COPY_AND_ASSIGN(SystemCapabilities);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
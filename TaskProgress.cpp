@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TaskProgress.h"
+
+#include <algorithm>
+
+namespace android {
+namespace vold {
+
+int TaskProgress::permille() {
+    // Sample "done" first: anything done has been discovered already, so this
+    // order can only underestimate.
+    uint64_t done = doneBytes() + doneInodes() * kInodeCost;
+    uint64_t total = discoveredBytes() + discoveredInodes() * kInodeCost;
+
+    int current = 0;
+    if (total > 0) {
+        current = static_cast<int>(std::min<uint64_t>(done * 1000 / total, 1000));
+    }
+
+    int last = mLastPermille.load(std::memory_order_relaxed);
+    while (current > last &&
+           !mLastPermille.compare_exchange_weak(last, current, std::memory_order_relaxed)) {
+    }
+    return std::max(current, last);
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_TASK_PROGRESS_H
+#define ANDROID_VOLD_TASK_PROGRESS_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace android {
+namespace vold {
+
+/*
+ * Progress accounting updated directly by the tree engines.
+ *
+ * Work is added as it is discovered during the walk and marked done as it
+ * completes, so nobody has to size the tree up front. Every inode is weighted
+ * as kInodeCost bytes on top of its data, so trees of many small files still
+ * report sensible progress. The reported fraction never goes backwards, even
+ * though the discovered total keeps growing while the walk is under way.
+ */
+class TaskProgress {
+  public:
+    static constexpr uint64_t kInodeCost = 16 * 1024;
+
+    void addDiscovered(uint64_t bytes, uint64_t inodes) {
+        mDiscoveredBytes.fetch_add(bytes, std::memory_order_relaxed);
+        mDiscoveredInodes.fetch_add(inodes, std::memory_order_relaxed);
+    }
+    void addDone(uint64_t bytes, uint64_t inodes) {
+        mDoneBytes.fetch_add(bytes, std::memory_order_relaxed);
+        mDoneInodes.fetch_add(inodes, std::memory_order_relaxed);
+    }
+
+    uint64_t discoveredBytes() const { return mDiscoveredBytes.load(std::memory_order_relaxed); }
+    uint64_t discoveredInodes() const { return mDiscoveredInodes.load(std::memory_order_relaxed); }
+    uint64_t doneBytes() const { return mDoneBytes.load(std::memory_order_relaxed); }
+    uint64_t doneInodes() const { return mDoneInodes.load(std::memory_order_relaxed); }
+
+    /* Completed share of the discovered work, in [0, 1000] */
+    int permille();
+
+    /* Maps permille() into [start, start + step] for IVoldTaskListener::onStatus */
+    int scaled(int start, int step) { return start + (permille() * step) / 1000; }
+
+  private:
+    std::atomic<uint64_t> mDiscoveredBytes{0};
+    std::atomic<uint64_t> mDiscoveredInodes{0};
+    std::atomic<uint64_t> mDoneBytes{0};
+    std::atomic<uint64_t> mDoneInodes{0};
+    std::atomic<int> mLastPermille{0};
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeCopy.h"
+#include "Utils.h"
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/scopeguard.h>
+#include <android-base/unique_fd.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <vector>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// Upper bound for a single copy_file_range()/sendfile() call, so that progress
+// keeps moving on very large files.
+static constexpr size_t kCopyChunk = 8 * 1024 * 1024;
+
+static int64_t ctimeNs(const struct stat& st) {
+    return st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+}
+
+struct TreeCopy::Dir {
+    TreeCopy* copy;
+    std::shared_ptr<Dir> parent;
+    std::string path;
+    // Path relative to the source root, as handed to the Journal
+    std::string rel;
+    unique_fd src;
+    unique_fd dst;
+    struct stat st;
+    // The top-level target keeps its own attributes, like with cp.
+    bool isRoot;
+    // Fingerprint of everything copied below this directory so far
+    std::mutex lock;
+    TreeSummary summary;
+
+    // Directory attributes are applied once the last child task lets go,
+    // since creating children would otherwise bump the copied mtime.
+    ~Dir() {
+        if (isRoot) {
+            copy->mSummary = summary;
+        } else if (dst.ok()) {
+            copy->finishDir(*this);
+        }
+    }
+};
+
+// Copies extended attributes between two open fds. Attributes that the
+// target filesystem or our credentials can't carry are skipped with a note,
+// as they were never preserved by the cp based implementation either.
+static void copyXattrs(int in, int out, const std::string& path) {
+    ssize_t len = flistxattr(in, nullptr, 0);
+    if (len <= 0) return;
+    std::vector<char> names(len);
+    len = flistxattr(in, names.data(), names.size());
+    if (len <= 0) return;
+
+    std::vector<char> value;
+    for (const char* name = names.data(); name < names.data() + len;
+         name += strlen(name) + 1) {
+        ssize_t size = fgetxattr(in, name, nullptr, 0);
+        if (size < 0) continue;
+        value.resize(size);
+        size = fgetxattr(in, name, value.data(), value.size());
+        if (size < 0) continue;
+        if (fsetxattr(out, name, value.data(), size, 0) != 0) {
+            if (errno == EPERM || errno == ENOTSUP || errno == EOPNOTSUPP) {
+                LOG(DEBUG) << "Skipping xattr " << name << " on " << path;
+            } else {
+                PLOG(WARNING) << "Failed to copy xattr " << name << " on " << path;
+            }
+        }
+    }
+}
+
+static status_t copyOwnerAndMode(int out, const std::string& path, const struct stat& st) {
+    // chown clears set-id bits, so the mode has to be applied afterwards
+    if (fchown(out, st.st_uid, st.st_gid) != 0) {
+        PLOG(ERROR) << "Failed to chown " << path;
+        return -errno;
+    }
+    if (fchmod(out, st.st_mode & 07777) != 0) {
+        PLOG(ERROR) << "Failed to chmod " << path;
+        return -errno;
+    }
+    return OK;
+}
+
+static status_t copyTimes(int dirFd, const char* name, int out, const std::string& path,
+                          const struct stat& st) {
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    int res = (out != -1) ? futimens(out, times)
+                          : utimensat(dirFd, name, times, AT_SYMLINK_NOFOLLOW);
+    if (res != 0) {
+        PLOG(ERROR) << "Failed to set times on " << path;
+        return -errno;
+    }
+    return OK;
+}
+
+TreeCopy::TreeCopy(const std::string& fromPath, const std::string& toPath, size_t threads)
+    : mFromPath(fromPath), mToPath(toPath), mPool(threads) {}
+
+TreeCopy::~TreeCopy() {
+    mPool.wait();
+}
+
+void TreeCopy::fail(status_t res) {
+    status_t expected = OK;
+    mResult.compare_exchange_strong(expected, res ? res : -EIO);
+}
+
+status_t TreeCopy::start() {
+    auto root = std::make_shared<Dir>();
+    root->copy = this;
+    root->path = mFromPath;
+    root->isRoot = true;
+
+    root->src.reset(open(mFromPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (root->src == -1) {
+        PLOG(ERROR) << "Failed to open " << mFromPath;
+        return -errno;
+    }
+    root->dst.reset(open(mToPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (root->dst == -1) {
+        PLOG(ERROR) << "Failed to open " << mToPath;
+        return -errno;
+    }
+
+    struct stat dstSt;
+    if (fstat(root->src, &root->st) != 0 || fstat(root->dst, &dstSt) != 0) {
+        PLOG(ERROR) << "Failed to stat " << mFromPath << " or " << mToPath;
+        return -errno;
+    }
+    mSameFs = root->st.st_dev == dstSt.st_dev;
+    root->summary.newestCtimeNs = ctimeNs(root->st);
+
+    mPool.submit([this, root]() { copyDir(root); });
+    return OK;
+}
+
+bool TreeCopy::waitFor(std::chrono::milliseconds timeout) {
+    return mPool.waitFor(timeout);
+}
+
+status_t TreeCopy::wait() {
+    mPool.wait();
+    return result();
+}
+
+void TreeCopy::enterDir(const std::shared_ptr<Dir>& parent, const std::string& name,
+                        const struct stat& st) {
+    auto dir = std::make_shared<Dir>();
+    dir->copy = this;
+    dir->parent = parent;
+    dir->path = parent->path + "/" + name;
+    dir->rel = parent->isRoot ? name : parent->rel + "/" + name;
+    dir->st = st;
+    dir->isRoot = false;
+    dir->summary.newestCtimeNs = ctimeNs(st);
+
+    dir->src.reset(openat(parent->src, name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    if (dir->src == -1) {
+        PLOG(ERROR) << "Failed to open " << dir->path;
+        fail(-errno);
+        return;
+    }
+
+    if (mJournal) {
+        // Only trust the journal when the target directory is still there
+        TreeSummary done;
+        unique_fd existing(openat(parent->dst, name.c_str(),
+                                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        if (existing != -1 && mJournal->isComplete(dir->rel, dir->src, &done)) {
+            LOG(VERBOSE) << "Skipping already copied " << dir->path;
+            // The directory itself was discovered when its parent was listed
+            mProgress.addDiscovered(done.bytes, done.entries);
+            mProgress.addDone(done.bytes, done.entries + 1);
+            std::lock_guard<std::mutex> lock(parent->lock);
+            parent->summary.add(done);
+            return;
+        }
+    }
+
+    if (mkdirat(parent->dst, name.c_str(), 0700) != 0 && errno != EEXIST) {
+        PLOG(ERROR) << "Failed to mkdir " << dir->path;
+        fail(-errno);
+        return;
+    }
+    dir->dst.reset(openat(parent->dst, name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    if (dir->dst == -1) {
+        PLOG(ERROR) << "Failed to open target of " << dir->path;
+        fail(-errno);
+        return;
+    }
+    mProgress.addDone(0, 1);
+    copyDir(dir);
+}
+
+void TreeCopy::copyDir(const std::shared_ptr<Dir>& dir) {
+    unique_fd fd(dup(dir->src));
+    if (fd == -1) {
+        PLOG(ERROR) << "Failed to dup " << dir->path;
+        fail(-errno);
+        return;
+    }
+    std::unique_ptr<DIR, decltype(&closedir)> dirp(android::base::Fdopendir(std::move(fd)),
+                                                   closedir);
+    if (!dirp) {
+        PLOG(ERROR) << "Failed to opendir " << dir->path;
+        fail(-errno);
+        return;
+    }
+
+    TreeSummary copied;
+    auto mergeSummary = android::base::make_scope_guard([&] {
+        std::lock_guard<std::mutex> lock(dir->lock);
+        dir->summary.bytes += copied.bytes;
+        dir->summary.entries += copied.entries;
+        dir->summary.newestCtimeNs = std::max(dir->summary.newestCtimeNs, copied.newestCtimeNs);
+    });
+
+    struct dirent* ent;
+    while (!failed() && (ent = readdir(dirp.get())) != nullptr) {
+        if (IsDotOrDotDot(*ent)) continue;
+
+        struct stat st;
+        if (fstatat(dir->src, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            PLOG(ERROR) << "Failed to stat " << dir->path << "/" << ent->d_name;
+            fail(-errno);
+            return;
+        }
+        mProgress.addDiscovered(S_ISREG(st.st_mode) ? st.st_size : 0, 1);
+
+        status_t res = OK;
+        switch (st.st_mode & S_IFMT) {
+            case S_IFDIR: {
+                std::string name(ent->d_name);
+                mPool.submit([this, dir, name, st]() { enterDir(dir, name, st); });
+                continue;
+            }
+            case S_IFREG:
+                res = copyFile(*dir, ent->d_name, st);
+                break;
+            case S_IFLNK:
+                res = copyLink(*dir, ent->d_name, st);
+                break;
+            default:
+                res = copySpecial(*dir, ent->d_name, st);
+                break;
+        }
+        if (res != OK) {
+            fail(res);
+            return;
+        }
+        mProgress.addDone(0, 1);
+        if (S_ISREG(st.st_mode)) copied.bytes += st.st_size;
+        copied.entries++;
+        copied.newestCtimeNs = std::max(copied.newestCtimeNs, ctimeNs(st));
+    }
+}
+
+void TreeCopy::finishDir(Dir& dir) {
+    if (failed()) return;
+    copyXattrs(dir.src, dir.dst, dir.path);
+    status_t res = copyOwnerAndMode(dir.dst, dir.path, dir.st);
+    if (res == OK) res = copyTimes(-1, nullptr, dir.dst, dir.path, dir.st);
+    if (res != OK) {
+        fail(res);
+        return;
+    }
+
+    // No child task is left at this point, so the summary is final
+    if (mJournal) mJournal->onComplete(dir.rel, dir.summary);
+    std::lock_guard<std::mutex> lock(dir.parent->lock);
+    dir.parent->summary.add(dir.summary);
+}
+
+status_t TreeCopy::copyFile(Dir& dir, const char* name, const struct stat& st) {
+    std::string path = dir.path + "/" + name;
+    unique_fd in(openat(dir.src, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+    if (in == -1) {
+        PLOG(ERROR) << "Failed to open " << path;
+        return -errno;
+    }
+    unique_fd out(openat(dir.dst, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+                         0600));
+    if (out == -1) {
+        PLOG(ERROR) << "Failed to create target of " << path;
+        return -errno;
+    }
+
+    status_t res = copyData(in, out, path, st);
+    if (res != OK) return res;
+
+    copyXattrs(in, out, path);
+    res = copyOwnerAndMode(out, path, st);
+    if (res != OK) return res;
+    return copyTimes(-1, nullptr, out, path, st);
+}
+
+status_t TreeCopy::copyData(int in, int out, const std::string& path, const struct stat& st) {
+    if (st.st_size == 0) return OK;
+
+    if (mSameFs && mCloneWorks.load(std::memory_order_relaxed)) {
+        if (ioctl(out, FICLONE, in) == 0) {
+            mProgress.addDone(st.st_size, 0);
+            return OK;
+        }
+        if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL || errno == EXDEV) {
+            // Filesystem doesn't do reflinks; don't bother asking again
+            mCloneWorks.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    bool useSendfile = false;
+    uint64_t copied = 0;
+    while (true) {
+        ssize_t n;
+        if (!useSendfile) {
+            n = copy_file_range(in, nullptr, out, nullptr, kCopyChunk, 0);
+            if (n == -1 && copied == 0 &&
+                (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                // Cross-filesystem copies aren't supported by every kernel
+                useSendfile = true;
+                continue;
+            }
+        } else {
+            n = sendfile(out, in, nullptr, kCopyChunk);
+        }
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            PLOG(ERROR) << "Failed to copy data of " << path;
+            return -errno;
+        }
+        if (n == 0) break;
+        copied += n;
+        mProgress.addDone(n, 0);
+    }
+    return OK;
+}
+
+status_t TreeCopy::copyLink(Dir& dir, const char* name, const struct stat& st) {
+    std::string path = dir.path + "/" + name;
+    std::string target;
+    if (!Readlinkat(dir.src, name, &target)) {
+        PLOG(ERROR) << "Failed to readlink " << path;
+        return -errno;
+    }
+    if (symlinkat(target.c_str(), dir.dst, name) != 0) {
+        if (errno != EEXIST || unlinkat(dir.dst, name, 0) != 0 ||
+            symlinkat(target.c_str(), dir.dst, name) != 0) {
+            PLOG(ERROR) << "Failed to create symlink " << path;
+            return -errno;
+        }
+    }
+    if (fchownat(dir.dst, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) != 0) {
+        PLOG(ERROR) << "Failed to chown symlink " << path;
+        return -errno;
+    }
+    return copyTimes(dir.dst, name, -1, path, st);
+}
+
+status_t TreeCopy::copySpecial(Dir& dir, const char* name, const struct stat& st) {
+    std::string path = dir.path + "/" + name;
+    if (mknodat(dir.dst, name, st.st_mode & (S_IFMT | 07777), st.st_rdev) != 0 &&
+        errno != EEXIST) {
+        PLOG(ERROR) << "Failed to mknod " << path;
+        return -errno;
+    }
+    if (fchownat(dir.dst, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) != 0 ||
+        fchmodat(dir.dst, name, st.st_mode & 07777, 0) != 0) {
+        PLOG(ERROR) << "Failed to set owner or mode of " << path;
+        return -errno;
+    }
+    return copyTimes(dir.dst, name, -1, path, st);
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_TREE_COPY_H
+#define ANDROID_VOLD_TREE_COPY_H
+
+#include "TaskProgress.h"
+#include "WorkStealingPool.h"
+
+#include <android-base/macros.h>
+#include <utils/Errors.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace android {
+namespace vold {
+
+/*
+ * Fingerprint of a source subtree: bytes in regular files, number of entries
+ * below the root, and the newest ctime of any of them or of the root itself.
+ * Anything that touches the subtree moves at least one of these.
+ */
+struct TreeSummary {
+    uint64_t bytes = 0;
+    uint64_t entries = 0;
+    int64_t newestCtimeNs = 0;
+
+    void add(const TreeSummary& child) {
+        bytes += child.bytes;
+        entries += child.entries + 1;
+        newestCtimeNs = std::max(newestCtimeNs, child.newestCtimeNs);
+    }
+    bool operator==(const TreeSummary& o) const {
+        return bytes == o.bytes && entries == o.entries && newestCtimeNs == o.newestCtimeNs;
+    }
+};
+
+/*
+ * In-process replacement for "cp -p -R -P -d": copies the contents of an
+ * existing directory into another existing directory, preserving ownership,
+ * mode, timestamps, extended attributes and symlinks. Subdirectories are
+ * spread over a WorkStealingPool; file data moves with FICLONE when both
+ * trees live on the same filesystem, and copy_file_range() otherwise.
+ */
+class TreeCopy {
+  public:
+    /*
+     * Optional hooks that make a copy resumable. Both are called from worker
+     * threads, with paths relative to the source root.
+     */
+    class Journal {
+      public:
+        virtual ~Journal() {}
+        /* Returns true if |relPath| was already copied; |srcFd| is the source directory */
+        virtual bool isComplete(const std::string& relPath, int srcFd, TreeSummary* summary) = 0;
+        /* Called once |relPath| and everything below it has been copied */
+        virtual void onComplete(const std::string& relPath, const TreeSummary& summary) = 0;
+    };
+
+    TreeCopy(const std::string& fromPath, const std::string& toPath,
+             size_t threads = WorkStealingPool::DefaultThreads());
+    ~TreeCopy();
+
+    /* Must be called before start(); |journal| has to outlive the copy */
+    void setJournal(Journal* journal) { mJournal = journal; }
+
+    /* Starts copying in the background */
+    status_t start();
+    /* Waits up to |timeout| for the copy to finish; returns true when done */
+    bool waitFor(std::chrono::milliseconds timeout);
+    /* Waits for the copy to finish and returns its result */
+    status_t wait();
+
+    /* Stops the copy as soon as possible, making |res| its result */
+    void cancel(status_t res) { fail(res); }
+
+    /* OK, or the first error encountered */
+    status_t result() const { return mResult.load(); }
+    /* Discovered and completed work, updated as the copy runs */
+    TaskProgress& progress() { return mProgress; }
+    /* Exact number of file data bytes written so far */
+    uint64_t bytes() const { return mProgress.doneBytes(); }
+    /* Number of files, directories and links created so far */
+    uint64_t inodes() const { return mProgress.doneInodes(); }
+    /* Fingerprint of the whole source tree; valid once the copy succeeded */
+    const TreeSummary& summary() const { return mSummary; }
+
+  private:
+    struct Dir;
+
+    void copyDir(const std::shared_ptr<Dir>& dir);
+    void enterDir(const std::shared_ptr<Dir>& parent, const std::string& name,
+                  const struct stat& st);
+    void finishDir(Dir& dir);
+    status_t copyFile(Dir& dir, const char* name, const struct stat& st);
+    status_t copyData(int in, int out, const std::string& path, const struct stat& st);
+    status_t copyLink(Dir& dir, const char* name, const struct stat& st);
+    status_t copySpecial(Dir& dir, const char* name, const struct stat& st);
+
+    void fail(status_t res);
+    bool failed() const { return mResult.load(std::memory_order_relaxed) != OK; }
+
+    const std::string mFromPath;
+    const std::string mToPath;
+    WorkStealingPool mPool;
+
+    Journal* mJournal = nullptr;
+    bool mSameFs = false;
+    std::atomic<bool> mCloneWorks{true};
+    std::atomic<status_t> mResult{OK};
+    TaskProgress mProgress;
+    // Set when the root is released, after the last task is done with it
+    TreeSummary mSummary;
+
+    DISALLOW_COPY_AND_ASSIGN(TreeCopy);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeDelete.h"
+#include "DirentReader.h"
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+struct TreeDelete::Dir {
+    TreeDelete* del;
+    std::shared_ptr<Dir> parent;
+    std::string name;
+    std::string path;
+    unique_fd fd;
+    int depth;
+
+    // The directory itself goes once the last child task lets go of it.
+    ~Dir() { del->finishDir(*this); }
+};
+
+TreeDelete::TreeDelete(const std::string& path, int minDepth, bool countBytes, size_t threads)
+    : mPath(path), mMinDepth(minDepth), mCountBytes(countBytes), mPool(threads) {}
+
+TreeDelete::~TreeDelete() {
+    mPool.wait();
+}
+
+void TreeDelete::fail(status_t res) {
+    status_t expected = OK;
+    mResult.compare_exchange_strong(expected, res ? res : -EIO);
+}
+
+status_t TreeDelete::start() {
+    unique_fd fd(open(mPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd == -1) {
+        if (errno == ENOENT) return OK;
+        PLOG(ERROR) << "Failed to open " << mPath;
+        return -errno;
+    }
+
+    auto root = std::make_shared<Dir>();
+    root->del = this;
+    root->path = mPath;
+    root->fd = std::move(fd);
+    root->depth = 0;
+
+    mPool.submit([this, root]() { deleteDir(root, ""); });
+    return OK;
+}
+
+bool TreeDelete::waitFor(std::chrono::milliseconds timeout) {
+    return mPool.waitFor(timeout);
+}
+
+status_t TreeDelete::wait() {
+    mPool.wait();
+    return result();
+}
+
+status_t TreeDelete::run() {
+    status_t res = start();
+    return (res == OK) ? wait() : res;
+}
+
+void TreeDelete::deleteDir(const std::shared_ptr<Dir>& parent, const std::string& name) {
+    std::shared_ptr<Dir> dir;
+    if (name.empty()) {
+        dir = parent;
+    } else {
+        unique_fd fd(openat(parent->fd, name.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        if (fd == -1) {
+            if (errno != ENOENT) {
+                PLOG(ERROR) << "Failed to open " << parent->path << "/" << name;
+                fail(-errno);
+            }
+            return;
+        }
+        dir = std::make_shared<Dir>();
+        dir->del = this;
+        dir->parent = parent;
+        dir->name = name;
+        dir->path = parent->path + "/" + name;
+        dir->fd = std::move(fd);
+        dir->depth = parent->depth + 1;
+    }
+
+    const bool removeEntries = dir->depth + 1 >= mMinDepth;
+    DirentReader reader(dir->fd);
+    DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        unsigned char type = entry.type;
+        struct stat st;
+        bool haveStat = false;
+        if (type == DT_UNKNOWN || (mCountBytes && type != DT_DIR && removeEntries)) {
+            if (fstatat(dir->fd, entry.name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                if (errno == ENOENT) continue;
+                PLOG(ERROR) << "Failed to stat " << dir->path << "/" << entry.name;
+                fail(-errno);
+                continue;
+            }
+            haveStat = true;
+            if (S_ISDIR(st.st_mode)) type = DT_DIR;
+        }
+
+        if (type == DT_DIR) {
+            if (removeEntries) mProgress.addDiscovered(0, 1);
+            std::string child(entry.name);
+            mPool.submit([this, dir, child]() { deleteDir(dir, child); });
+            continue;
+        }
+        if (!removeEntries) continue;
+
+        const uint64_t bytes = (haveStat && mCountBytes) ? st.st_blocks * 512 : 0;
+        mProgress.addDiscovered(bytes, 1);
+        if (unlinkat(dir->fd, entry.name, 0) != 0) {
+            if (errno == ENOENT) continue;
+            PLOG(ERROR) << "Failed to unlink " << dir->path << "/" << entry.name;
+            fail(-errno);
+            continue;
+        }
+        mProgress.addDone(bytes, 1);
+    }
+    if (reader.error() != 0) {
+        errno = reader.error();
+        PLOG(ERROR) << "Failed to read " << dir->path;
+        fail(-errno);
+    }
+}
+
+void TreeDelete::finishDir(Dir& dir) {
+    if (dir.depth < mMinDepth) return;
+
+    int res = dir.parent ? unlinkat(dir.parent->fd, dir.name.c_str(), AT_REMOVEDIR)
+                         : rmdir(mPath.c_str());
+    if (res != 0) {
+        if (errno == ENOENT) return;
+        PLOG(ERROR) << "Failed to rmdir " << dir.path;
+        fail(-errno);
+        return;
+    }
+    mProgress.addDone(0, 1);
+}
+
+}  // namespace vold
+}  // namespace android
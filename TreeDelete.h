@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_TREE_DELETE_H
+#define ANDROID_VOLD_TREE_DELETE_H
+
+#include "TaskProgress.h"
+#include "WorkStealingPool.h"
+
+#include <android-base/macros.h>
+#include <utils/Errors.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace android {
+namespace vold {
+
+/*
+ * Parallel "rm -rf" built on getdents64() and unlinkat().
+ *
+ * Only entries at least |minDepth| levels below |path| are removed: 1 empties
+ * |path|, 2 keeps its immediate children but empties those, and 0 removes
+ * |path| as well. Directories are handed to a WorkStealingPool and removed
+ * once their last child is gone. Like rm -f, a missing |path| is not an error
+ * and the walk keeps going past individual failures; the first one is
+ * reported by result().
+ */
+class TreeDelete {
+  public:
+    TreeDelete(const std::string& path, int minDepth = 1, bool countBytes = false,
+               size_t threads = WorkStealingPool::DefaultThreads());
+    ~TreeDelete();
+
+    /* Starts deleting in the background */
+    status_t start();
+    /* Waits up to |timeout| for the delete to finish; returns true when done */
+    bool waitFor(std::chrono::milliseconds timeout);
+    /* Waits for the delete to finish and returns its result */
+    status_t wait();
+    /* Equivalent to start() followed by wait() */
+    status_t run();
+
+    /* OK, or the first error encountered */
+    status_t result() const { return mResult.load(); }
+    /* Discovered and completed work, updated as the delete runs */
+    TaskProgress& progress() { return mProgress; }
+    /* Allocated bytes released so far; only tracked when |countBytes| is set */
+    uint64_t bytes() const { return mProgress.doneBytes(); }
+    /* Number of files, directories and links removed so far */
+    uint64_t inodes() const { return mProgress.doneInodes(); }
+
+  private:
+    struct Dir;
+
+    void deleteDir(const std::shared_ptr<Dir>& parent, const std::string& name);
+    void finishDir(Dir& dir);
+    void fail(status_t res);
+
+    const std::string mPath;
+    const int mMinDepth;
+    const bool mCountBytes;
+    WorkStealingPool mPool;
+
+    std::atomic<status_t> mResult{OK};
+    TaskProgress mProgress;
+
+    DISALLOW_COPY_AND_ASSIGN(TreeDelete);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
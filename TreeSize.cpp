@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeSize.h"
+#include "DirentReader.h"
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// The block count is all we need; the link count only decides whether an
+// inode has to go through the hard link set. Asking for less lets network
+// and FUSE filesystems skip work, and DONT_SYNC keeps them from revalidating.
+static constexpr unsigned int kStatxMask = STATX_BLOCKS | STATX_NLINK;
+static constexpr int kStatxFlags = AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC;
+
+// How many entries a worker handles between looks at the clock
+static constexpr unsigned int kBudgetCheckInterval = 256;
+
+struct TreeSize::Dir {
+    std::string path;
+    unique_fd fd;
+};
+
+TreeSize::TreeSize(const std::string& path, size_t threads) : mPath(path), mPool(threads) {}
+
+TreeSize::~TreeSize() {
+    mPool.wait();
+}
+
+void TreeSize::fail(status_t res) {
+    status_t expected = OK;
+    mResult.compare_exchange_strong(expected, res ? res : -EIO);
+}
+
+bool TreeSize::expired() {
+    if (mBudget.count() == 0) return false;
+    if (mExpired.load(std::memory_order_relaxed)) return true;
+    if (std::chrono::steady_clock::now() < mDeadline) return false;
+    if (!mExpired.exchange(true)) {
+        LOG(WARNING) << "Gave up sizing " << mPath << " after " << mBudget.count() << "ms";
+    }
+    return true;
+}
+
+bool TreeSize::firstLink(uint64_t dev, uint64_t ino) {
+    LinkShard& shard = mLinks[ino % kLinkShards];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.seen.emplace(dev, ino).second;
+}
+
+void TreeSize::account(const struct statx& stx, uint64_t ino, bool isDir) {
+    // stx_dev is always filled in; d_ino saves asking for STATX_INO
+    if (!isDir && !mEveryLink && stx.stx_nlink > 1 &&
+        !firstLink(makedev(stx.stx_dev_major, stx.stx_dev_minor), ino)) {
+        return;
+    }
+
+    // Count actual blocks used instead of nominal file size, rounded up to
+    // the filesystem block size
+    uint64_t size = stx.stx_blocks * 512;
+    if (stx.stx_blksize) {
+        size = (size + stx.stx_blksize - 1) & ~(uint64_t(stx.stx_blksize) - 1);
+    }
+    mBytes.fetch_add(size, std::memory_order_relaxed);
+    mInodes.fetch_add(1, std::memory_order_relaxed);
+}
+
+status_t TreeSize::start() {
+    unique_fd fd(open(mPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd == -1) {
+        PLOG(WARNING) << "Failed to open " << mPath;
+        return -errno;
+    }
+
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC, kStatxMask, &stx) != 0) {
+        PLOG(WARNING) << "Failed to stat " << mPath;
+        return -errno;
+    }
+    account(stx, 0, true);
+
+    if (mBudget.count() != 0) mDeadline = std::chrono::steady_clock::now() + mBudget;
+
+    auto root = std::make_shared<Dir>();
+    root->path = mPath;
+    root->fd = std::move(fd);
+    mPool.submit([this, root]() { sizeDir(root, ""); });
+    return OK;
+}
+
+bool TreeSize::waitFor(std::chrono::milliseconds timeout) {
+    return mPool.waitFor(timeout);
+}
+
+status_t TreeSize::wait() {
+    mPool.wait();
+    return result();
+}
+
+status_t TreeSize::run() {
+    status_t res = start();
+    return (res == OK) ? wait() : res;
+}
+
+void TreeSize::sizeDir(const std::shared_ptr<Dir>& parent, const std::string& name) {
+    if (expired()) return;
+
+    std::shared_ptr<Dir> dir;
+    if (name.empty()) {
+        dir = parent;
+    } else {
+        unique_fd fd(openat(parent->fd, name.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+        if (fd == -1) {
+            if (errno != ENOENT) {
+                PLOG(WARNING) << "Failed to open " << parent->path << "/" << name;
+                fail(-errno);
+            }
+            return;
+        }
+        dir = std::make_shared<Dir>();
+        dir->path = parent->path + "/" + name;
+        dir->fd = std::move(fd);
+    }
+
+    DirentReader reader(dir->fd);
+    DirentReader::Entry entry;
+    unsigned int count = 0;
+    while (reader.next(&entry)) {
+        if (++count % kBudgetCheckInterval == 0 && expired()) return;
+
+        unsigned int mask = kStatxMask;
+        if (entry.type == DT_UNKNOWN) mask |= STATX_TYPE;
+        struct statx stx;
+        if (statx(dir->fd, entry.name, kStatxFlags, mask, &stx) != 0) {
+            if (errno == ENOENT) continue;
+            PLOG(WARNING) << "Failed to stat " << dir->path << "/" << entry.name;
+            fail(-errno);
+            continue;
+        }
+        bool isDir = (entry.type == DT_UNKNOWN) ? S_ISDIR(stx.stx_mode) : entry.type == DT_DIR;
+        account(stx, entry.ino, isDir);
+        if (isDir) {
+            std::string child(entry.name);
+            mPool.submit([this, dir, child]() { sizeDir(dir, child); });
+        }
+    }
+    if (reader.error() != 0) {
+        errno = reader.error();
+        PLOG(WARNING) << "Failed to read " << dir->path;
+        fail(-errno);
+    }
+}
+
+}  // namespace vold
+}  // namespace android
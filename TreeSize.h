@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_TREE_SIZE_H
+#define ANDROID_VOLD_TREE_SIZE_H
+
+#include "WorkStealingPool.h"
+
+#include <android-base/macros.h>
+#include <utils/Errors.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+namespace android {
+namespace vold {
+
+/*
+ * Parallel "du" of a directory tree: the allocated size of |path| and
+ * everything below it, rounded up to the filesystem block size.
+ *
+ * Directories are read with getdents64() and spread over a WorkStealingPool,
+ * and entries are examined with statx() asking only for the block count, so
+ * filesystems don't have to fill in anything else. Files with several hard
+ * links inside the tree are counted once unless setCountEveryLink() says
+ * otherwise. Entries that vanish during the walk
+ * are ignored; the first other error is reported by result() but the walk
+ * carries on.
+ */
+class TreeSize {
+  public:
+    explicit TreeSize(const std::string& path,
+                      size_t threads = WorkStealingPool::DefaultThreads());
+    ~TreeSize();
+
+    /* Must be called before start(); once |budget| runs out the walk stops early */
+    void setTimeBudget(std::chrono::milliseconds budget) { mBudget = budget; }
+    /* Must be called before start(); sizes every hard link as a file of its own */
+    void setCountEveryLink(bool everyLink) { mEveryLink = everyLink; }
+
+    /* Starts sizing in the background */
+    status_t start();
+    /* Waits up to |timeout| for the walk to finish; returns true when done */
+    bool waitFor(std::chrono::milliseconds timeout);
+    /* Waits for the walk to finish and returns its result */
+    status_t wait();
+    /* Equivalent to start() followed by wait() */
+    status_t run();
+
+    /* OK, or the first error encountered */
+    status_t result() const { return mResult.load(); }
+    /* Allocated bytes found so far */
+    uint64_t bytes() const { return mBytes.load(std::memory_order_relaxed); }
+    /* Distinct inodes found so far, including |path| itself */
+    uint64_t inodes() const { return mInodes.load(std::memory_order_relaxed); }
+    /* False if the time budget ran out, in which case bytes() is a lower bound */
+    bool complete() const { return !mExpired.load(std::memory_order_relaxed); }
+
+  private:
+    struct Dir;
+
+    void sizeDir(const std::shared_ptr<Dir>& parent, const std::string& name);
+    void account(const struct statx& stx, uint64_t ino, bool isDir);
+    bool firstLink(uint64_t dev, uint64_t ino);
+    bool expired();
+    void fail(status_t res);
+
+    // Hard link dedup set of (dev, ino), sharded by inode to keep workers apart
+    static constexpr size_t kLinkShards = 16;
+    using LinkKey = std::pair<uint64_t, uint64_t>;
+    struct LinkKeyHash {
+        size_t operator()(const LinkKey& key) const {
+            return std::hash<uint64_t>()(key.first * 31 + key.second);
+        }
+    };
+    struct LinkShard {
+        std::mutex lock;
+        std::unordered_set<LinkKey, LinkKeyHash> seen;
+    };
+
+    const std::string mPath;
+    WorkStealingPool mPool;
+
+    std::chrono::milliseconds mBudget{0};
+    bool mEveryLink = false;
+    std::chrono::steady_clock::time_point mDeadline;
+    std::atomic<bool> mExpired{false};
+
+    LinkShard mLinks[kLinkShards];
+    std::atomic<uint64_t> mBytes{0};
+    std::atomic<uint64_t> mInodes{0};
+    std::atomic<status_t> mResult{OK};
+
+    DISALLOW_COPY_AND_ASSIGN(TreeSize);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -16,7 +16,15 @@
 
 #include "Utils.h"
 
+#include "DirentReader.h"
+#include "FileWaiter.h"
+#include "FsProbe.h"
+#include "MountTree.h"
 #include "Process.h"
+#include "SystemCapabilities.h"
+#include "TreeDelete.h"
+#include "TreeSize.h"
+#include "WorkStealingPool.h"
 #include "sehandle.h"
 
 #include <android-base/chrono_utils.h>
@@ -38,18 +46,23 @@
 #include <linux/posix_acl.h>
 #include <linux/posix_acl_xattr.h>
 #include <mntent.h>
+#include <poll.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <filesystem>
+#include <functional>
 #include <list>
 #include <mutex>
 #include <regex>
@@ -74,14 +87,14 @@ char* sBlkidUntrustedContext = nullptr;
 char* sFsckContext = nullptr;
 char* sFsckUntrustedContext = nullptr;
 
-bool sSleepOnUnmount = true;
+std::atomic<bool> sSleepOnUnmount = true;
+
+// How long a timed out helper gets to exit after SIGTERM before SIGKILL
+static constexpr std::chrono::milliseconds kTerminateGracePeriod = 2s;
 
 static const char* kBlkidPath = "/system/bin/blkid";
 static const char* kKeyPath = "/data/misc/vold";
 
-static const char* kProcDevices = "/proc/devices";
-static const char* kProcFilesystems = "/proc/filesystems";
-
 static const char* kAndroidDir = "/Android/";
 static const char* kAppDataDir = "/Android/data/";
 static const char* kAppMediaDir = "/Android/media/";
@@ -139,23 +152,18 @@ status_t DestroyDeviceNode(const std::string& path) {
     }
 }
 
-// Sets a default ACL on the directory.
-status_t SetDefaultAcl(const std::string& path, mode_t mode, uid_t uid, gid_t gid,
-                       std::vector<gid_t> additionalGids) {
-    if (IsSdcardfsUsed()) {
-        // sdcardfs magically takes care of this
-        return OK;
-    }
-
+// Builds the system.posix_acl_default value for the given mode and owners.
+static std::vector<uint8_t> BuildDefaultAcl(mode_t mode, uid_t uid, gid_t gid,
+                                            const std::vector<gid_t>& additionalGids) {
     size_t num_entries = 3 + (additionalGids.size() > 0 ? additionalGids.size() + 1 : 0);
     size_t size = sizeof(posix_acl_xattr_header) + num_entries * sizeof(posix_acl_xattr_entry);
-    auto buf = std::make_unique<uint8_t[]>(size);
+    std::vector<uint8_t> buf(size);
 
-    posix_acl_xattr_header* acl_header = reinterpret_cast<posix_acl_xattr_header*>(buf.get());
+    posix_acl_xattr_header* acl_header = reinterpret_cast<posix_acl_xattr_header*>(buf.data());
     acl_header->a_version = POSIX_ACL_XATTR_VERSION;
 
     posix_acl_xattr_entry* entry =
-            reinterpret_cast<posix_acl_xattr_entry*>(buf.get() + sizeof(posix_acl_xattr_header));
+            reinterpret_cast<posix_acl_xattr_entry*>(buf.data() + sizeof(posix_acl_xattr_header));
 
     int tag_index = 0;
 
@@ -193,7 +201,19 @@ status_t SetDefaultAcl(const std::string& path, mode_t mode, uid_t uid, gid_t gi
     entry[tag_index].e_perm = mode & S_IRWXO;
     entry[tag_index].e_id = 0;
 
-    int ret = setxattr(path.c_str(), XATTR_NAME_POSIX_ACL_DEFAULT, acl_header, size, 0);
+    return buf;
+}
+
+// Sets a default ACL on the directory.
+status_t SetDefaultAcl(const std::string& path, mode_t mode, uid_t uid, gid_t gid,
+                       std::vector<gid_t> additionalGids) {
+    if (IsSdcardfsUsed()) {
+        // sdcardfs magically takes care of this
+        return OK;
+    }
+
+    std::vector<uint8_t> acl = BuildDefaultAcl(mode, uid, gid, additionalGids);
+    int ret = setxattr(path.c_str(), XATTR_NAME_POSIX_ACL_DEFAULT, acl.data(), acl.size(), 0);
 
     if (ret != 0) {
         PLOG(ERROR) << "Failed to set default ACL on " << path;
@@ -202,15 +222,26 @@ status_t SetDefaultAcl(const std::string& path, mode_t mode, uid_t uid, gid_t gi
     return ret;
 }
 
-int SetQuotaInherit(const std::string& path) {
-    unsigned int flags;
+// As above, on the directory open on |fd|; |path| is only for logging.
+static status_t SetDefaultAcl(int fd, const std::string& path, mode_t mode, uid_t uid, gid_t gid,
+                              const std::vector<gid_t>& additionalGids) {
+    if (IsSdcardfsUsed()) {
+        return OK;
+    }
 
-    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
-    if (fd == -1) {
-        PLOG(ERROR) << "Failed to open " << path << " to set project id inheritance.";
-        return -1;
+    std::vector<uint8_t> acl = BuildDefaultAcl(mode, uid, gid, additionalGids);
+    int ret = fsetxattr(fd, XATTR_NAME_POSIX_ACL_DEFAULT, acl.data(), acl.size(), 0);
+
+    if (ret != 0) {
+        PLOG(ERROR) << "Failed to set default ACL on " << path;
     }
 
+    return ret;
+}
+
+static int SetQuotaInherit(int fd, const std::string& path) {
+    unsigned int flags;
+
     int ret = ioctl(fd, FS_IOC_GETFLAGS, &flags);
     if (ret == -1) {
         PLOG(ERROR) << "Failed to get flags for " << path << " to set project id inheritance.";
@@ -228,15 +259,19 @@ int SetQuotaInherit(const std::string& path) {
     return 0;
 }
 
-int SetQuotaProjectId(const std::string& path, long projectId) {
-    struct fsxattr fsx;
-
+int SetQuotaInherit(const std::string& path) {
     android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
     if (fd == -1) {
-        PLOG(ERROR) << "Failed to open " << path << " to set project id.";
+        PLOG(ERROR) << "Failed to open " << path << " to set project id inheritance.";
         return -1;
     }
 
+    return SetQuotaInherit(fd, path);
+}
+
+static int SetQuotaProjectId(int fd, const std::string& path, long projectId) {
+    struct fsxattr fsx;
+
     int ret = ioctl(fd, FS_IOC_FSGETXATTR, &fsx);
     if (ret == -1) {
         PLOG(ERROR) << "Failed to get extended attributes for " << path << " to get project id.";
@@ -252,6 +287,16 @@ int SetQuotaProjectId(const std::string& path, long projectId) {
     return 0;
 }
 
+int SetQuotaProjectId(const std::string& path, long projectId) {
+    android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+    if (fd == -1) {
+        PLOG(ERROR) << "Failed to open " << path << " to set project id.";
+        return -1;
+    }
+
+    return SetQuotaProjectId(fd, path, projectId);
+}
+
 int PrepareDirWithProjectId(const std::string& path, mode_t mode, uid_t uid, gid_t gid,
                             long projectId) {
     int ret = fs_prepare_dir(path.c_str(), mode, uid, gid);
@@ -267,47 +312,216 @@ int PrepareDirWithProjectId(const std::string& path, mode_t mode, uid_t uid, gid
     return ret;
 }
 
-static int FixupAppDir(const std::string& path, mode_t mode, uid_t uid, gid_t gid, long projectId) {
-    namespace fs = std::filesystem;
+// fs_prepare_dir() for |name| under |parentFd|: creates the directory if it is
+// missing, fixes its mode and owner if they differ, and returns it open in
+// |fd| for the caller to keep working on. Symlinks are never followed.
+// |path| is only for logging.
+static status_t PrepareDirAt(int parentFd, const std::string& name, const std::string& path,
+                             mode_t mode, uid_t uid, gid_t gid, android::base::unique_fd* fd) {
+    constexpr int kFlags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    constexpr mode_t kAllPerms = S_ISUID | S_ISGID | S_ISVTX | S_IRWXU | S_IRWXG | S_IRWXO;
 
-    // Setup the directory itself correctly
-    int ret = PrepareDirWithProjectId(path, mode, uid, gid, projectId);
-    if (ret != OK) {
-        return ret;
+    fd->reset(TEMP_FAILURE_RETRY(openat(parentFd, name.c_str(), kFlags)));
+    if (*fd == -1 && errno == ENOENT) {
+        if (TEMP_FAILURE_RETRY(mkdirat(parentFd, name.c_str(), mode)) == -1 && errno != EEXIST) {
+            PLOG(ERROR) << "Failed to create " << path;
+            return -errno;
+        }
+        fd->reset(TEMP_FAILURE_RETRY(openat(parentFd, name.c_str(), kFlags)));
+    }
+    if (*fd == -1) {
+        PLOG(ERROR) << "Failed to open " << path;
+        return -errno;
     }
 
-    // Fixup all of its file entries
-    for (const auto& itEntry : fs::directory_iterator(path)) {
-        ret = lchown(itEntry.path().c_str(), uid, gid);
-        if (ret != 0) {
-            return ret;
-        }
+    struct stat sb;
+    if (fstat(*fd, &sb) == -1) {
+        PLOG(ERROR) << "Failed to stat " << path;
+        return -errno;
+    }
+    // mkdirat() is subject to the umask and never sets S_ISGID itself
+    if ((sb.st_mode & kAllPerms) != mode && TEMP_FAILURE_RETRY(fchmod(*fd, mode)) == -1) {
+        PLOG(ERROR) << "Failed to chmod " << path;
+        return -errno;
+    }
+    if ((sb.st_uid != uid || sb.st_gid != gid) && TEMP_FAILURE_RETRY(fchown(*fd, uid, gid)) == -1) {
+        PLOG(ERROR) << "Failed to chown " << path;
+        return -errno;
+    }
+    return OK;
+}
 
-        ret = chmod(itEntry.path().c_str(), mode);
-        if (ret != 0) {
-            return ret;
+// Directories with fewer entries than this are fixed up on the calling
+// thread; larger ones are split into batches across a WorkStealingPool.
+static constexpr size_t kFixupParallelThreshold = 512;
+static constexpr size_t kFixupBatchSize = 128;
+
+// Brings entry |name| of the directory |dirFd| in line. Most entries already
+// are, and only cost a statx() and, with project quota, FS_IOC_FSGETXATTR.
+// Symlinks only get their owner fixed; following them could touch anything
+// on the device.
+static int FixupAppDirEntry(int dirFd, const char* name, const std::string& path, mode_t mode,
+                            uid_t uid, gid_t gid, long projectId, bool setProjectId) {
+    std::string entryPath = path + name;
+    struct statx stx;
+    if (statx(dirFd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID,
+              &stx) != 0) {
+        // The app may be deleting files while we go
+        if (errno == ENOENT) return OK;
+        PLOG(ERROR) << "Failed to stat " << entryPath;
+        return -errno;
+    }
+
+    bool ownerMatches = stx.stx_uid == uid && stx.stx_gid == gid;
+    if (S_ISLNK(stx.stx_mode)) {
+        if (!ownerMatches && fchownat(dirFd, name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0) {
+            PLOG(ERROR) << "Failed to chown " << entryPath;
+            return -errno;
         }
+        return OK;
+    }
+    bool modeMatches = (stx.stx_mode & 07777) == mode;
+    if (ownerMatches && modeMatches && !setProjectId) return OK;
 
-        if (!IsSdcardfsUsed()) {
-            ret = SetQuotaProjectId(itEntry.path(), projectId);
-            if (ret != 0) {
-                return ret;
+    android::base::unique_fd entryFd(TEMP_FAILURE_RETRY(
+            openat(dirFd, name, O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC)));
+    if (entryFd == -1) {
+        if (errno == ENOENT) return OK;
+        PLOG(ERROR) << "Failed to open " << entryPath;
+        return -errno;
+    }
+
+    if (!ownerMatches && fchown(entryFd, uid, gid) != 0) {
+        PLOG(ERROR) << "Failed to chown " << entryPath;
+        return -errno;
+    }
+
+    // chown() clears S_ISGID on files, so the mode always follows it
+    if ((!ownerMatches || !modeMatches) && fchmod(entryFd, mode) != 0) {
+        PLOG(ERROR) << "Failed to chmod " << entryPath;
+        return -errno;
+    }
+
+    if (setProjectId) {
+        struct fsxattr fsx;
+        if (ioctl(entryFd, FS_IOC_FSGETXATTR, &fsx) == -1) {
+            PLOG(ERROR) << "Failed to get extended attributes for " << entryPath
+                        << " to get project id.";
+            return -1;
+        }
+        if (fsx.fsx_projid != static_cast<__u32>(projectId)) {
+            fsx.fsx_projid = projectId;
+            if (ioctl(entryFd, FS_IOC_FSSETXATTR, &fsx) == -1) {
+                PLOG(ERROR) << "Failed to set project id on " << entryPath;
+                return -1;
             }
         }
     }
-
     return OK;
 }
 
+// Fixes up the owner, mode and project ID of every entry in the open
+// directory |fd|, which was already prepared itself.
+static int FixupAppDir(int fd, const std::string& path, mode_t mode, uid_t uid, gid_t gid,
+                       long projectId) {
+    bool setProjectId = !IsSdcardfsUsed();
+
+    std::vector<std::string> names;
+    DirentReader reader(fd);
+    DirentReader::Entry entry;
+    while (reader.next(&entry)) {
+        names.emplace_back(entry.name);
+    }
+    if (reader.error() != 0) {
+        errno = reader.error();
+        PLOG(ERROR) << "Failed to read " << path;
+        return -errno;
+    }
+
+    if (names.size() < kFixupParallelThreshold) {
+        for (const auto& name : names) {
+            int ret = FixupAppDirEntry(fd, name.c_str(), path, mode, uid, gid, projectId,
+                                       setProjectId);
+            if (ret != OK) return ret;
+        }
+        return OK;
+    }
+
+    // Report the first failure; batches that start after it bail out early
+    std::atomic<int> result = OK;
+    WorkStealingPool pool;
+    for (size_t start = 0; start < names.size(); start += kFixupBatchSize) {
+        size_t end = std::min(start + kFixupBatchSize, names.size());
+        pool.submit([&, start, end]() {
+            for (size_t i = start; i < end && result.load(std::memory_order_relaxed) == OK;
+                 i++) {
+                int ret = FixupAppDirEntry(fd, names[i].c_str(), path, mode, uid, gid, projectId,
+                                           setProjectId);
+                if (ret != OK) {
+                    int expected = OK;
+                    result.compare_exchange_strong(expected, ret);
+                }
+            }
+        });
+    }
+    pool.wait();
+    return result;
+}
+
+// The fd based PrepareAndroidDirs(), which also hands back Android/ itself.
+static status_t PrepareAndroidDirs(int rootFd, const std::string& volumeRoot,
+                                   android::base::unique_fd* androidFd) {
+    bool useSdcardFs = IsSdcardfsUsed();
+
+    // mode 0771 + sticky bit for inheriting GIDs
+    mode_t mode = S_IRWXU | S_IRWXG | S_IXOTH | S_ISGID;
+    status_t res = PrepareDirAt(rootFd, "Android", volumeRoot + kAndroidDir, mode, AID_MEDIA_RW,
+                                AID_MEDIA_RW, androidFd);
+    if (res != OK) {
+        return res;
+    }
+
+    android::base::unique_fd fd;
+    gid_t dataGid = useSdcardFs ? AID_MEDIA_RW : AID_EXT_DATA_RW;
+    res = PrepareDirAt(*androidFd, "data", volumeRoot + kAppDataDir, mode, AID_MEDIA_RW, dataGid,
+                       &fd);
+    if (res != OK) {
+        return res;
+    }
+
+    gid_t obbGid = useSdcardFs ? AID_MEDIA_RW : AID_EXT_OBB_RW;
+    res = PrepareDirAt(*androidFd, "obb", volumeRoot + kAppObbDir, mode, AID_MEDIA_RW, obbGid,
+                       &fd);
+    if (res != OK) {
+        return res;
+    }
+    // Some other apps, like installers, have write access to the OBB directory
+    // to pre-download them. To make sure newly created folders in this directory
+    // have the right permissions, set a default ACL.
+    SetDefaultAcl(fd, volumeRoot + kAppObbDir, mode, AID_MEDIA_RW, obbGid, {});
+
+    return PrepareDirAt(*androidFd, "media", volumeRoot + kAppMediaDir, mode, AID_MEDIA_RW,
+                        AID_MEDIA_RW, &fd);
+}
+
 int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int appUid,
                           bool fixupExisting) {
     long projectId;
-    size_t pos;
     int ret = 0;
     bool sdcardfsSupport = IsSdcardfsUsed();
 
+    // Everything below is done relative to open directories, so no path is
+    // resolved more than once, however deep the volume root is.
+    android::base::unique_fd rootFd(
+            TEMP_FAILURE_RETRY(open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+    if (rootFd == -1) {
+        PLOG(ERROR) << "Failed to open " << root;
+        return -errno;
+    }
+
     // Make sure the Android/ directories exist and are setup correctly
-    ret = PrepareAndroidDirs(root);
+    android::base::unique_fd androidFd;
+    ret = PrepareAndroidDirs(rootFd, root, &androidFd);
     if (ret != 0) {
         LOG(ERROR) << "Failed to prepare Android/ directories.";
         return ret;
@@ -322,10 +536,12 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
     gid_t gid = AID_MEDIA_RW;
     std::vector<gid_t> additionalGids;
     std::string appDir;
+    const char* appDirName;
 
     // Check that the next part matches one of the allowed Android/ dirs
     if (StartsWith(pathFromRoot, kAppDataDir)) {
         appDir = kAppDataDir;
+        appDirName = "data";
         if (!sdcardfsSupport) {
             gid = AID_EXT_DATA_RW;
             // Also add the app's own UID as a group; since apps belong to a group
@@ -335,11 +551,13 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
         }
     } else if (StartsWith(pathFromRoot, kAppMediaDir)) {
         appDir = kAppMediaDir;
+        appDirName = "media";
         if (!sdcardfsSupport) {
             gid = AID_MEDIA_RW;
         }
     } else if (StartsWith(pathFromRoot, kAppObbDir)) {
         appDir = kAppObbDir;
+        appDirName = "obb";
         if (!sdcardfsSupport) {
             gid = AID_EXT_OBB_RW;
             // See comments for kAppDataDir above
@@ -357,11 +575,9 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
     // derived from their uid
 
     // Chop off the generic application-specific part, eg /Android/data/
-    // this leaves us with something like com.foo/files/
-    std::string leftToCreate = pathFromRoot.substr(appDir.length());
-    if (!EndsWith(leftToCreate, "/")) {
-        leftToCreate += "/";
-    }
+    // this leaves us with something like com.foo/files
+    std::vector<std::string> components =
+            android::base::Split(pathFromRoot.substr(appDir.length()), "/");
     std::string pathToCreate = root + appDir;
     int depth = 0;
     // Derive initial project ID
@@ -371,12 +587,24 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
         projectId = uid - AID_APP_START + PROJECT_ID_EXT_OBB_START;
     }
 
-    while ((pos = leftToCreate.find('/')) != std::string::npos) {
-        std::string component = leftToCreate.substr(0, pos + 1);
-        leftToCreate = leftToCreate.erase(0, pos + 1);
-        pathToCreate = pathToCreate + component;
+    android::base::unique_fd parentFd(TEMP_FAILURE_RETRY(
+            openat(androidFd, appDirName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)));
+    if (parentFd == -1) {
+        PLOG(ERROR) << "Failed to open " << pathToCreate;
+        return -errno;
+    }
+
+    for (const auto& component : components) {
+        if (component.empty()) {
+            continue;
+        }
+        if (component == "." || component == "..") {
+            LOG(ERROR) << "Invalid application directory: " << path;
+            return -EINVAL;
+        }
+        pathToCreate += component + "/";
 
-        if (appDir == kAppDataDir && depth == 1 && component == "cache/") {
+        if (appDir == kAppDataDir && depth == 1 && component == "cache") {
             // All dirs use the "app" project ID, except for the cache dirs in
             // Android/data, eg Android/data/com.foo/cache
             // Note that this "sticks" - eg subdirs of this dir need the same
@@ -384,12 +612,15 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
             projectId = uid - AID_APP_START + PROJECT_ID_EXT_CACHE_START;
         }
 
-        if (fixupExisting && access(pathToCreate.c_str(), F_OK) == 0) {
+        android::base::unique_fd fd;
+        ret = PrepareDirAt(parentFd, component, pathToCreate, mode, uid, gid, &fd);
+        if (ret == 0 && !sdcardfsSupport) {
+            ret = SetQuotaProjectId(fd, pathToCreate, projectId);
+        }
+        if (ret == 0 && fixupExisting) {
             // Fixup all files in this existing directory with the correct UID/GID
-            // and project ID.
-            ret = FixupAppDir(pathToCreate, mode, uid, gid, projectId);
-        } else {
-            ret = PrepareDirWithProjectId(pathToCreate, mode, uid, gid, projectId);
+            // and project ID; a directory that was just created has none.
+            ret = FixupAppDir(fd, pathToCreate, mode, uid, gid, projectId);
         }
 
         if (ret != 0) {
@@ -404,7 +635,7 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
             // installers and MTP, that require access here.
             //
             // See man (5) acl for more details.
-            ret = SetDefaultAcl(pathToCreate, mode, uid, gid, additionalGids);
+            ret = SetDefaultAcl(fd, pathToCreate, mode, uid, gid, additionalGids);
             if (ret != 0) {
                 return ret;
             }
@@ -412,13 +643,14 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
             if (!sdcardfsSupport) {
                 // Set project ID inheritance, so that future subdirectories inherit the
                 // same project ID
-                ret = SetQuotaInherit(pathToCreate);
+                ret = SetQuotaInherit(fd, pathToCreate);
                 if (ret != 0) {
                     return ret;
                 }
             }
         }
 
+        parentFd = std::move(fd);
         depth++;
     }
 
@@ -476,76 +708,155 @@ status_t PrepareDir(const std::string& path, mode_t mode, uid_t uid, gid_t gid,
     return OK;
 }
 
-status_t ForceUnmount(const std::string& path) {
-    const char* cpath = path.c_str();
-    if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
-        return OK;
+// How long each escalation stage waits for the processes it signalled
+static constexpr std::chrono::milliseconds kKillStageTimeout = 5s;
+// Backoff between retries while waiting out a stage
+static constexpr std::chrono::milliseconds kKillStageRetryMin = 10ms;
+static constexpr std::chrono::milliseconds kKillStageRetryMax = 500ms;
+
+static void RaiseKillStage(KillStage* stage, KillStage reached) {
+    if (stage != nullptr && *stage < reached) *stage = reached;
+}
+
+static bool TryUnmount(const char* cpath) {
+    return !umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT;
+}
+
+// Waits up to |timeout| for any of the processes behind |pidfds| to exit,
+// dropping those that did. Returns true if one did.
+static bool WaitForAnyPidfd(std::vector<unique_fd>* pidfds, std::chrono::milliseconds timeout) {
+    std::vector<struct pollfd> fds;
+    for (const auto& pidfd : *pidfds) fds.push_back({.fd = pidfd.get(), .events = POLLIN});
+    int ret = poll(fds.data(), fds.size(), timeout.count());
+    if (ret < 0 && errno != EINTR) {
+        PLOG(WARNING) << "Failed to poll pidfds";
+        pidfds->clear();
+        return true;
     }
-    // Apps might still be handling eject request, so wait before
-    // we start sending signals
-    if (sSleepOnUnmount) sleep(5);
+    if (ret <= 0) return false;
 
-    KillProcessesWithOpenFiles(path, SIGINT);
-    if (sSleepOnUnmount) sleep(5);
-    if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
-        return OK;
+    for (size_t i = fds.size(); i-- > 0;) {
+        if (fds[i].revents) pidfds->erase(pidfds->begin() + i);
     }
+    return true;
+}
 
-    KillProcessesWithOpenFiles(path, SIGTERM);
-    if (sSleepOnUnmount) sleep(5);
-    if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
-        return OK;
+// Waits up to |timeout| for the processes behind |pidfds| to exit, dropping
+// each one as it does. Returns early once none are left.
+static void WaitForPidfds(std::vector<unique_fd>* pidfds, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!pidfds->empty()) {
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (remaining <= 0ms) return;
+        WaitForAnyPidfd(pidfds, remaining);
     }
+}
 
-    KillProcessesWithOpenFiles(path, SIGKILL);
-    if (sSleepOnUnmount) sleep(5);
-    if (!umount2(cpath, UMOUNT_NOFOLLOW) || errno == EINVAL || errno == ENOENT) {
-        return OK;
+// Waits out one escalation stage, until |done| holds or kKillStageTimeout
+// passes; |done| is always the last thing called. A cheap |done| is retried
+// with backoff, waking early when the last process signalled in this stage
+// exits. An |expensive| one, which scans /proc, is only retried when one of
+// those processes exits or at the deadline, and with backoff only when there
+// are no pidfds to wait on.
+static bool WaitForKillStage(std::vector<unique_fd>* pidfds, const std::function<bool()>& done,
+                             bool expensive = false) {
+    if (!sSleepOnUnmount) return done();
+
+    auto deadline = std::chrono::steady_clock::now() + kKillStageTimeout;
+    auto delay = kKillStageRetryMin;
+    bool onExit = expensive && !pidfds->empty();
+    while (true) {
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        // Whoever cleared sSleepOnUnmount is out of time; stop waiting
+        if (remaining <= 0ms || !sSleepOnUnmount) return done();
+        if (onExit) {
+            // Bounded slices only so that a cleared sSleepOnUnmount is noticed
+            if (WaitForAnyPidfd(pidfds, std::min(kKillStageRetryMax, remaining)) && done()) {
+                return true;
+            }
+            continue;
+        }
+        auto wait = std::min(delay, remaining);
+        if (pidfds->empty()) {
+            std::this_thread::sleep_for(wait);
+        } else {
+            WaitForPidfds(pidfds, wait);
+        }
+        if (done()) return true;
+        delay = std::min(delay * 2, kKillStageRetryMax);
     }
-    PLOG(INFO) << "ForceUnmount failed";
-    return -errno;
 }
 
-status_t KillProcessesWithTmpfsMountPrefix(const std::string& path) {
-    if (KillProcessesWithTmpfsMounts(path, SIGINT) == 0) {
+static const std::pair<int, KillStage> kKillStages[] = {
+        {SIGINT, KillStage::kSigint},
+        {SIGTERM, KillStage::kSigterm},
+        {SIGKILL, KillStage::kSigkill},
+};
+
+status_t ForceUnmount(const std::string& path, KillStage* stage) {
+    const char* cpath = path.c_str();
+    if (TryUnmount(cpath)) {
         return OK;
     }
-    if (sSleepOnUnmount) sleep(5);
-
-    if (KillProcessesWithTmpfsMounts(path, SIGTERM) == 0) {
+    // Apps might still be handling eject request, so wait before
+    // we start sending signals
+    std::vector<unique_fd> pidfds;
+    auto unmounted = [cpath]() { return TryUnmount(cpath); };
+    if (WaitForKillStage(&pidfds, unmounted)) {
         return OK;
     }
-    if (sSleepOnUnmount) sleep(5);
 
-    if (KillProcessesWithTmpfsMounts(path, SIGKILL) == 0) {
-        return OK;
+    for (const auto& [signal, reached] : kKillStages) {
+        RaiseKillStage(stage, reached);
+        KillProcessesWithOpenFiles(path, signal, true /* killFuseDaemon */, &pidfds);
+        if (WaitForKillStage(&pidfds, unmounted)) {
+            return OK;
+        }
+    }
+    RaiseKillStage(stage, KillStage::kFailed);
+    PLOG(INFO) << "ForceUnmount failed";
+    return -errno;
+}
+
+status_t KillProcessesWithTmpfsMountPrefix(const std::string& path, KillStage* stage) {
+    std::vector<unique_fd> pidfds;
+    auto released = [&path]() { return !HasProcessesWithTmpfsMounts(path); };
+    for (const auto& [signal, reached] : kKillStages) {
+        if (KillProcessesWithTmpfsMounts(path, signal, &pidfds) == 0) {
+            return OK;
+        }
+        RaiseKillStage(stage, reached);
+        if (WaitForKillStage(&pidfds, released, true /* expensive */)) {
+            return OK;
+        }
     }
-    if (sSleepOnUnmount) sleep(5);
 
     // Send SIGKILL a second time to determine if we've
     // actually killed everyone mount
     if (KillProcessesWithTmpfsMounts(path, SIGKILL) == 0) {
         return OK;
     }
+    RaiseKillStage(stage, KillStage::kFailed);
     PLOG(ERROR) << "Failed to kill processes using " << path;
     return -EBUSY;
 }
 
-status_t KillProcessesUsingPath(const std::string& path) {
-    if (KillProcessesWithOpenFiles(path, SIGINT, false /* killFuseDaemon */) == 0) {
-        return OK;
-    }
-    if (sSleepOnUnmount) sleep(5);
-
-    if (KillProcessesWithOpenFiles(path, SIGTERM, false /* killFuseDaemon */) == 0) {
-        return OK;
-    }
-    if (sSleepOnUnmount) sleep(5);
-
-    if (KillProcessesWithOpenFiles(path, SIGKILL, false /* killFuseDaemon */) == 0) {
-        return OK;
+status_t KillProcessesUsingPath(const std::string& path, KillStage* stage) {
+    std::vector<unique_fd> pidfds;
+    auto released = [&path]() {
+        return !HasProcessesWithOpenFiles(path, false /* includeFuseDaemon */);
+    };
+    for (const auto& [signal, reached] : kKillStages) {
+        if (KillProcessesWithOpenFiles(path, signal, false /* killFuseDaemon */, &pidfds) == 0) {
+            return OK;
+        }
+        RaiseKillStage(stage, reached);
+        if (WaitForKillStage(&pidfds, released, true /* expensive */)) {
+            return OK;
+        }
     }
-    if (sSleepOnUnmount) sleep(5);
 
     // Send SIGKILL a second time to determine if we've
     // actually killed everyone with open files
@@ -553,10 +864,94 @@ status_t KillProcessesUsingPath(const std::string& path) {
     if (KillProcessesWithOpenFiles(path, SIGKILL, true /* killFuseDaemon */) == 0) {
         return OK;
     }
+    RaiseKillStage(stage, KillStage::kFailed);
     PLOG(ERROR) << "Failed to kill processes using " << path;
     return -EBUSY;
 }
 
+// Selected mounts with no selected mount below them, newest first; each
+// roots its own subtree
+static std::vector<size_t> SelectedRoots(const MountTree& tree, const std::vector<char>& selected) {
+    const auto& mounts = tree.mounts();
+    std::vector<size_t> roots;
+    for (size_t i = mounts.size(); i-- > 0;) {
+        if (!selected[i]) continue;
+        bool nested = false;
+        size_t p = mounts[i].parent;
+        for (size_t hops = 0; p != MountTree::kNoParent && hops < mounts.size(); hops++) {
+            if (selected[p]) {
+                nested = true;
+                break;
+            }
+            p = mounts[p].parent;
+        }
+        if (!nested) roots.push_back(i);
+    }
+    return roots;
+}
+
+status_t ForceUnmountMatching(const std::function<bool(const std::string& mountPoint)>& select) {
+    MountTree tree;
+    if (!tree.load()) {
+        PLOG(ERROR) << "Failed to read mountinfo";
+        return -errno;
+    }
+    const auto& mounts = tree.mounts();
+    std::vector<char> selected(mounts.size());
+    for (size_t i = 0; i < mounts.size(); i++) selected[i] = select(mounts[i].mountPoint);
+
+    auto roots = SelectedRoots(tree, selected);
+    if (roots.empty()) return OK;
+
+    std::atomic<status_t> firstError = OK;
+    WorkStealingPool pool(std::min(roots.size(), WorkStealingPool::DefaultThreads()));
+    for (size_t root : roots) {
+        pool.submit([&, root]() {
+            android::base::Timer timer;
+            size_t count = 0;
+            for (size_t i : tree.postOrder(root)) {
+                if (!selected[i]) continue;
+                const auto& mount = mounts[i];
+                bool blocked = std::any_of(mount.children.begin(), mount.children.end(),
+                                           [&](size_t child) { return !selected[child]; });
+                status_t res;
+                if (blocked) {
+                    LOG(INFO) << "Detaching " << mount.mountPoint << " from under other mounts";
+                    res = UnmountTree(mount.mountPoint);
+                } else {
+                    LOG(DEBUG) << "Tearing down stale mount " << mount.mountPoint;
+                    res = ForceUnmount(mount.mountPoint);
+                }
+                status_t expected = OK;
+                if (res != OK) firstError.compare_exchange_strong(expected, res);
+                count++;
+            }
+            LOG(INFO) << "Unmounted " << count << " mounts under " << mounts[root].mountPoint
+                      << " in " << timer;
+        });
+    }
+    pool.wait();
+    return firstError;
+}
+
+status_t DetachMatching(const std::function<bool(const std::string& mountPoint)>& select) {
+    MountTree tree;
+    if (!tree.load()) {
+        PLOG(ERROR) << "Failed to read mountinfo";
+        return -errno;
+    }
+    const auto& mounts = tree.mounts();
+    std::vector<char> selected(mounts.size());
+    for (size_t i = 0; i < mounts.size(); i++) selected[i] = select(mounts[i].mountPoint);
+
+    status_t res = OK;
+    for (size_t root : SelectedRoots(tree, selected)) {
+        LOG(INFO) << "Detaching " << mounts[root].mountPoint;
+        if (UnmountTree(mounts[root].mountPoint) != OK) res = -errno;
+    }
+    return res;
+}
+
 status_t BindMount(const std::string& source, const std::string& target) {
     if (UnmountTree(target) < 0) {
         return -errno;
@@ -633,6 +1028,20 @@ static status_t readMetadata(const std::string& path, std::string* fsType, std::
     fsUuid->clear();
     fsLabel->clear();
 
+    // Trusted devices are probed in-process to save a fork and exec on every
+    // mount; blkid still handles untrusted media in its own sandboxed domain,
+    // and anything the prober doesn't recognize.
+    if (!untrusted) {
+        android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        FsProbeResult probe;
+        if (fd != -1 && ProbeFilesystem(fd, &probe) == OK) {
+            *fsType = probe.type;
+            *fsUuid = probe.uuid;
+            *fsLabel = probe.label;
+            return OK;
+        }
+    }
+
     std::vector<std::string> cmd;
     cmd.push_back(kBlkidPath);
     cmd.push_back("-c");
@@ -703,6 +1112,50 @@ static status_t ReadLinesFromFdAndLog(std::vector<std::string>* output,
     return OK;
 }
 
+// Starts |argv| with posix_spawnp(), which shares vold's address space with
+// the child until it execs instead of copying vold's page tables like fork()
+// does; that copy grows with vold's RSS. The SELinux exec context is per
+// thread and inherited by the child, so it is set around the spawn. With
+// |stdoutFd| the child's stdout goes there; with -1, stdin, stdout and stderr
+// are all closed. Every other fd vold holds is O_CLOEXEC.
+static status_t Spawn(const std::vector<const char*>& argv, const char* context, int stdoutFd,
+                      pid_t* pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    auto guard = android::base::make_scope_guard(
+            [&actions] { posix_spawn_file_actions_destroy(&actions); });
+    if (stdoutFd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+    } else {
+        posix_spawn_file_actions_addclose(&actions, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, STDERR_FILENO);
+    }
+
+    if (context && setexeccon(context)) {
+        PLOG(ERROR) << "Failed to setexeccon for " << argv[0];
+        return -EPERM;
+    }
+    int res = posix_spawnp(pid, argv[0], &actions, nullptr, const_cast<char**>(argv.data()),
+                           environ);
+    if (context && setexeccon(nullptr)) {
+        // Anything this thread execs later would run in the wrong domain
+        PLOG(FATAL) << "Failed to reset exec context after spawning " << argv[0];
+    }
+    if (res != 0) {
+        errno = res;
+        PLOG(ERROR) << "posix_spawnp " << argv[0];
+        return -res;
+    }
+    return OK;
+}
+
+status_t SpawnProcess(const std::vector<std::string>& args, char* context, int stdoutFd,
+                      pid_t* pid) {
+    auto argv = ConvertToArgv(args);
+    return Spawn(argv, context, stdoutFd, pid);
+}
+
 status_t ForkExecvp(const std::vector<std::string>& args, std::vector<std::string>* output,
                     char* context) {
     auto argv = ConvertToArgv(args);
@@ -713,28 +1166,9 @@ status_t ForkExecvp(const std::vector<std::string>& args, std::vector<std::strin
         return -errno;
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        if (context) {
-            if (setexeccon(context)) {
-                LOG(ERROR) << "Failed to setexeccon in ForkExecvp";
-                abort();
-            }
-        }
-        pipe_read.reset();
-        if (dup2(pipe_write.get(), STDOUT_FILENO) == -1) {
-            PLOG(ERROR) << "dup2 in ForkExecvp";
-            _exit(EXIT_FAILURE);
-        }
-        pipe_write.reset();
-        execvp(argv[0], const_cast<char**>(argv.data()));
-        PLOG(ERROR) << "exec in ForkExecvp";
-        _exit(EXIT_FAILURE);
-    }
-    if (pid == -1) {
-        PLOG(ERROR) << "fork in ForkExecvp";
-        return -errno;
-    }
+    pid_t pid;
+    status_t res = Spawn(argv, context, pipe_write.get(), &pid);
+    if (res != OK) return res;
 
     pipe_write.reset();
     auto st = ReadLinesFromFdAndLog(output, std::move(pipe_read));
@@ -756,40 +1190,58 @@ status_t ForkExecvp(const std::vector<std::string>& args, std::vector<std::strin
     return OK;
 }
 
+// Waits for |pid| to exit and reaps it. Uses a pidfd where the kernel has
+// them, and otherwise polls waitpid() with a backoff. Returns -ETIMEDOUT,
+// leaving |pid| unreaped, if it is still running after |timeout|.
+static status_t WaitPidFor(pid_t pid, std::chrono::milliseconds timeout, int* status) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    unique_fd pidfd(syscall(__NR_pidfd_open, pid, 0));
+    if (pidfd != -1) {
+        struct pollfd pfd = {.fd = pidfd.get(), .events = POLLIN};
+        while (true) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            int res = poll(&pfd, 1, std::max<int64_t>(left.count(), 0));
+            if (res > 0) break;
+            if (res == 0) return -ETIMEDOUT;
+            if (errno != EINTR) return -errno;
+        }
+    } else {
+        auto delay = 1ms;
+        while (true) {
+            pid_t res = waitpid(pid, status, WNOHANG);
+            if (res == pid) return OK;
+            if (res == -1 && errno != EINTR) return -errno;
+            if (std::chrono::steady_clock::now() >= deadline) return -ETIMEDOUT;
+            std::this_thread::sleep_for(delay);
+            delay = std::min<std::chrono::milliseconds>(delay * 2, 100ms);
+        }
+    }
+    if (TEMP_FAILURE_RETRY(waitpid(pid, status, 0)) == -1) return -errno;
+    return OK;
+}
+
 status_t ForkExecvpTimeout(const std::vector<std::string>& args, std::chrono::seconds timeout,
                            char* context) {
-    int status;
+    pid_t pid = ForkExecvpAsync(args, context);
+    if (pid == -1) return -ECHILD;
 
-    pid_t wait_timeout_pid = fork();
-    if (wait_timeout_pid == 0) {
-        pid_t pid = ForkExecvpAsync(args, context);
-        if (pid == -1) {
-            _exit(EXIT_FAILURE);
-        }
-        pid_t timer_pid = fork();
-        if (timer_pid == 0) {
-            std::this_thread::sleep_for(timeout);
-            _exit(ETIMEDOUT);
-        }
-        if (timer_pid == -1) {
-            PLOG(ERROR) << "fork in ForkExecvpAsync_timeout";
-            kill(pid, SIGTERM);
-            _exit(EXIT_FAILURE);
-        }
-        pid_t finished = wait(&status);
-        if (finished == pid) {
-            kill(timer_pid, SIGTERM);
-        } else {
-            kill(pid, SIGTERM);
-        }
-        if (!WIFEXITED(status)) {
-            _exit(ECHILD);
+    int status;
+    status_t res = WaitPidFor(pid, timeout, &status);
+    if (res == -ETIMEDOUT) {
+        LOG(ERROR) << args[0] << " timed out after " << timeout.count() << "s";
+        // Give it a chance to exit cleanly, but don't leave it behind
+        kill(pid, SIGTERM);
+        if (WaitPidFor(pid, kTerminateGracePeriod, &status) != OK) {
+            kill(pid, SIGKILL);
+            TEMP_FAILURE_RETRY(waitpid(pid, &status, 0));
         }
-        _exit(WEXITSTATUS(status));
+        return ETIMEDOUT;
     }
-    if (waitpid(wait_timeout_pid, &status, 0) == -1) {
-        PLOG(ERROR) << "waitpid in ForkExecvpAsync_timeout";
-        return -errno;
+    if (res != OK) {
+        errno = -res;
+        PLOG(ERROR) << "waitpid in ForkExecvpTimeout";
+        return res;
     }
     if (!WIFEXITED(status)) {
         LOG(ERROR) << "Process did not exit normally, status: " << status;
@@ -805,26 +1257,8 @@ status_t ForkExecvpTimeout(const std::vector<std::string>& args, std::chrono::se
 pid_t ForkExecvpAsync(const std::vector<std::string>& args, char* context) {
     auto argv = ConvertToArgv(args);
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        close(STDIN_FILENO);
-        close(STDOUT_FILENO);
-        close(STDERR_FILENO);
-        if (context) {
-            if (setexeccon(context)) {
-                LOG(ERROR) << "Failed to setexeccon in ForkExecvpAsync";
-                abort();
-            }
-        }
-
-        execvp(argv[0], const_cast<char**>(argv.data()));
-        PLOG(ERROR) << "exec in ForkExecvpAsync";
-        _exit(EXIT_FAILURE);
-    }
-    if (pid == -1) {
-        PLOG(ERROR) << "fork in ForkExecvpAsync";
-        return -1;
-    }
+    pid_t pid;
+    if (Spawn(argv, context, -1, &pid) != OK) return -1;
     return pid;
 }
 
@@ -978,64 +1412,12 @@ uint64_t GetFreeBytes(const std::string& path) {
     }
 }
 
-// TODO: borrowed from frameworks/native/libs/diskusage/ which should
-// eventually be migrated into system/
-static int64_t stat_size(struct stat* s) {
-    int64_t blksize = s->st_blksize;
-    // count actual blocks used instead of nominal file size
-    int64_t size = s->st_blocks * 512;
-
-    if (blksize) {
-        /* round up to filesystem block size */
-        size = (size + blksize - 1) & (~(blksize - 1));
-    }
-
-    return size;
-}
-
-// TODO: borrowed from frameworks/native/libs/diskusage/ which should
-// eventually be migrated into system/
-int64_t calculate_dir_size(int dfd) {
-    int64_t size = 0;
-    struct stat s;
-    DIR* d;
-    struct dirent* de;
-
-    d = fdopendir(dfd);
-    if (d == NULL) {
-        close(dfd);
-        return 0;
-    }
-
-    while ((de = readdir(d))) {
-        const char* name = de->d_name;
-        if (fstatat(dfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
-            size += stat_size(&s);
-        }
-        if (de->d_type == DT_DIR) {
-            int subfd;
-
-            /* always skip "." and ".." */
-            if (IsDotOrDotDot(*de)) continue;
-
-            subfd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
-            if (subfd >= 0) {
-                size += calculate_dir_size(subfd);
-            }
-        }
-    }
-    closedir(d);
-    return size;
-}
-
-uint64_t GetTreeBytes(const std::string& path) {
-    int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
-    if (dirfd < 0) {
-        PLOG(WARNING) << "Failed to open " << path;
-        return -1;
-    } else {
-        return calculate_dir_size(dirfd);
-    }
+uint64_t GetTreeBytes(const std::string& path, bool countEveryLink) {
+    TreeSize size(path);
+    size.setCountEveryLink(countEveryLink);
+    if (size.start() != OK) return -1;
+    size.wait();
+    return size.bytes();
 }
 
 // TODO: Use a better way to determine if it's media provider app.
@@ -1052,17 +1434,11 @@ bool IsFuseDaemon(const pid_t pid) {
 }
 
 bool IsFilesystemSupported(const std::string& fsType) {
-    std::string supported;
-    if (!ReadFileToString(kProcFilesystems, &supported)) {
-        PLOG(ERROR) << "Failed to read supported filesystems";
-        return false;
-    }
-    return supported.find(fsType + "\n") != std::string::npos;
+    return SystemCapabilities::Get().isFilesystemSupported(fsType);
 }
 
 bool IsSdcardfsUsed() {
-    return IsFilesystemSupported("sdcardfs") &&
-           base::GetBoolProperty(kExternalStorageSdcardfs, true);
+    return SystemCapabilities::Get().isSdcardfsUsed();
 }
 
 status_t WipeBlockDevice(const std::string& path) {
@@ -1227,30 +1603,6 @@ bool Readlinkat(int dirfd, const std::string& path, std::string* result) {
     }
 }
 
-static unsigned int GetMajorBlockVirtioBlk() {
-    std::string devices;
-    if (!ReadFileToString(kProcDevices, &devices)) {
-        PLOG(ERROR) << "Unable to open /proc/devices";
-        return 0;
-    }
-
-    bool blockSection = false;
-    for (auto line : android::base::Split(devices, "\n")) {
-        if (line == "Block devices:") {
-            blockSection = true;
-        } else if (line == "Character devices:") {
-            blockSection = false;
-        } else if (blockSection) {
-            auto tokens = android::base::Split(line, " ");
-            if (tokens.size() == 2 && tokens[1] == "virtblk") {
-                return std::stoul(tokens[0]);
-            }
-        }
-    }
-
-    return 0;
-}
-
 bool IsVirtioBlkDevice(unsigned int major) {
     // Most virtualized platforms expose block devices with the virtio-blk
     // block device driver. Unfortunately, this driver does not use a fixed
@@ -1258,8 +1610,8 @@ bool IsVirtioBlkDevice(unsigned int major) {
     // range of block majors, which are allocated for "LOCAL/EXPERIMENAL USE"
     // per Documentation/devices.txt. This is true even for the latest Linux
     // kernel (4.4; see init() in drivers/block/virtio_blk.c).
-    static unsigned int kMajorBlockVirtioBlk = GetMajorBlockVirtioBlk();
-    return kMajorBlockVirtioBlk && major == kMajorBlockVirtioBlk;
+    unsigned int virtioBlkMajor = SystemCapabilities::Get().virtioBlkMajor();
+    return virtioBlkMajor && major == virtioBlkMajor;
 }
 
 status_t UnmountTree(const std::string& mountPoint) {
@@ -1275,89 +1627,21 @@ bool IsDotOrDotDot(const struct dirent& ent) {
     return strcmp(ent.d_name, ".") == 0 || strcmp(ent.d_name, "..") == 0;
 }
 
-static status_t delete_dir_contents(DIR* dir) {
-    // Shamelessly borrowed from android::installd
-    int dfd = dirfd(dir);
-    if (dfd < 0) {
-        return -errno;
-    }
-
-    status_t result = OK;
-    struct dirent* de;
-    while ((de = readdir(dir))) {
-        const char* name = de->d_name;
-        if (de->d_type == DT_DIR) {
-            /* always skip "." and ".." */
-            if (IsDotOrDotDot(*de)) continue;
-
-            android::base::unique_fd subfd(
-                openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
-            if (subfd.get() == -1) {
-                PLOG(ERROR) << "Couldn't openat " << name;
-                result = -errno;
-                continue;
-            }
-            std::unique_ptr<DIR, decltype(&closedir)> subdirp(
-                android::base::Fdopendir(std::move(subfd)), closedir);
-            if (!subdirp) {
-                PLOG(ERROR) << "Couldn't fdopendir " << name;
-                result = -errno;
-                continue;
-            }
-            result = delete_dir_contents(subdirp.get());
-            if (unlinkat(dfd, name, AT_REMOVEDIR) < 0) {
-                PLOG(ERROR) << "Couldn't unlinkat " << name;
-                result = -errno;
-            }
-        } else {
-            if (unlinkat(dfd, name, 0) < 0) {
-                PLOG(ERROR) << "Couldn't unlinkat " << name;
-                result = -errno;
-            }
-        }
-    }
-    return result;
-}
-
 status_t DeleteDirContentsAndDir(const std::string& pathname) {
-    status_t res = DeleteDirContents(pathname);
+    status_t res = TreeDelete(pathname, 0).run();
     if (res < 0) {
         return res;
     }
-    if (TEMP_FAILURE_RETRY(rmdir(pathname.c_str())) < 0 && errno != ENOENT) {
-        PLOG(ERROR) << "rmdir failed on " << pathname;
-        return -errno;
-    }
     LOG(VERBOSE) << "Success: rmdir on " << pathname;
     return OK;
 }
 
 status_t DeleteDirContents(const std::string& pathname) {
-    // Shamelessly borrowed from android::installd
-    std::unique_ptr<DIR, decltype(&closedir)> dirp(opendir(pathname.c_str()), closedir);
-    if (!dirp) {
-        if (errno == ENOENT) {
-            return OK;
-        }
-        PLOG(ERROR) << "Failed to opendir " << pathname;
-        return -errno;
-    }
-    return delete_dir_contents(dirp.get());
+    return TreeDelete(pathname, 1).run();
 }
 
-// TODO(118708649): fix duplication with init/util.h
 status_t WaitForFile(const char* filename, std::chrono::nanoseconds timeout) {
-    android::base::Timer t;
-    while (t.duration() < timeout) {
-        struct stat sb;
-        if (stat(filename, &sb) != -1) {
-            LOG(INFO) << "wait for '" << filename << "' took " << t;
-            return 0;
-        }
-        std::this_thread::sleep_for(10ms);
-    }
-    LOG(WARNING) << "wait for '" << filename << "' timed out and took " << t;
-    return -1;
+    return FileWaiter::Instance()->waitFor(filename, timeout);
 }
 
 bool pathExists(const std::string& path) {
@@ -1682,42 +1966,15 @@ status_t UnmountUserFuse(userid_t user_id, const std::string& absolute_lower_pat
 }
 
 status_t PrepareAndroidDirs(const std::string& volumeRoot) {
-    std::string androidDir = volumeRoot + kAndroidDir;
-    std::string androidDataDir = volumeRoot + kAppDataDir;
-    std::string androidObbDir = volumeRoot + kAppObbDir;
-    std::string androidMediaDir = volumeRoot + kAppMediaDir;
-
-    bool useSdcardFs = IsSdcardfsUsed();
-
-    // mode 0771 + sticky bit for inheriting GIDs
-    mode_t mode = S_IRWXU | S_IRWXG | S_IXOTH | S_ISGID;
-    if (fs_prepare_dir(androidDir.c_str(), mode, AID_MEDIA_RW, AID_MEDIA_RW) != 0) {
-        PLOG(ERROR) << "Failed to create " << androidDir;
+    android::base::unique_fd rootFd(
+            TEMP_FAILURE_RETRY(open(volumeRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+    if (rootFd == -1) {
+        PLOG(ERROR) << "Failed to open " << volumeRoot;
         return -errno;
     }
 
-    gid_t dataGid = useSdcardFs ? AID_MEDIA_RW : AID_EXT_DATA_RW;
-    if (fs_prepare_dir(androidDataDir.c_str(), mode, AID_MEDIA_RW, dataGid) != 0) {
-        PLOG(ERROR) << "Failed to create " << androidDataDir;
-        return -errno;
-    }
-
-    gid_t obbGid = useSdcardFs ? AID_MEDIA_RW : AID_EXT_OBB_RW;
-    if (fs_prepare_dir(androidObbDir.c_str(), mode, AID_MEDIA_RW, obbGid) != 0) {
-        PLOG(ERROR) << "Failed to create " << androidObbDir;
-        return -errno;
-    }
-    // Some other apps, like installers, have write access to the OBB directory
-    // to pre-download them. To make sure newly created folders in this directory
-    // have the right permissions, set a default ACL.
-    SetDefaultAcl(androidObbDir, mode, AID_MEDIA_RW, obbGid, {});
-
-    if (fs_prepare_dir(androidMediaDir.c_str(), mode, AID_MEDIA_RW, AID_MEDIA_RW) != 0) {
-        PLOG(ERROR) << "Failed to create " << androidMediaDir;
-        return -errno;
-    }
-
-    return OK;
+    android::base::unique_fd androidFd;
+    return PrepareAndroidDirs(rootFd, volumeRoot, &androidFd);
 }
 
 namespace ab = android::base;
@@ -1769,44 +2026,16 @@ std::pair<android::base::unique_fd, std::string> OpenDirInProcfs(std::string_vie
     return {std::move(fd), std::move(linkPath)};
 }
 
-static bool IsPropertySet(const char* name, bool& value) {
-    if (base::GetProperty(name, "") == "") return false;
-
-    value = base::GetBoolProperty(name, false);
-    LOG(INFO) << "fuse-bpf is " << (value ? "enabled" : "disabled") << " because of property "
-              << name;
-    return true;
-}
-
 bool IsFuseBpfEnabled() {
-    // This logic is reproduced in packages/providers/MediaProvider/jni/FuseDaemon.cpp
-    // so changes made here must be reflected there
-    bool enabled = false;
-
-    if (IsPropertySet("ro.fuse.bpf.is_running", enabled)) return enabled;
-
-    if (!IsPropertySet("persist.sys.fuse.bpf.override", enabled) &&
-        !IsPropertySet("ro.fuse.bpf.enabled", enabled)) {
-        // If the kernel has fuse-bpf, /sys/fs/fuse/features/fuse_bpf will exist and have the
-        // contents 'supported\n' - see fs/fuse/inode.c in the kernel source
-        std::string contents;
-        const char* filename = "/sys/fs/fuse/features/fuse_bpf";
-        if (!base::ReadFileToString(filename, &contents)) {
-            LOG(INFO) << "fuse-bpf is disabled because " << filename << " cannot be read";
-            enabled = false;
-        } else if (contents == "supported\n") {
-            LOG(INFO) << "fuse-bpf is enabled because " << filename << " reads 'supported'";
-            enabled = true;
-        } else {
-            LOG(INFO) << "fuse-bpf is disabled because " << filename
-                      << " does not read 'supported'";
-            enabled = false;
-        }
-    }
-
-    std::string value = enabled ? "true" : "false";
-    LOG(INFO) << "Setting ro.fuse.bpf.is_running to " << value;
-    base::SetProperty("ro.fuse.bpf.is_running", value);
+    bool enabled = SystemCapabilities::Get().isFuseBpfEnabled();
+
+    // Tell MediaProvider what was decided, once
+    static std::once_flag published;
+    std::call_once(published, [enabled] {
+        std::string value = enabled ? "true" : "false";
+        LOG(INFO) << "Setting ro.fuse.bpf.is_running to " << value;
+        base::SetProperty("ro.fuse.bpf.is_running", value);
+    });
     return enabled;
 }
 
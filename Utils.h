@@ -25,7 +25,9 @@
 #include <selinux/selinux.h>
 #include <utils/Errors.h>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -47,7 +49,7 @@ extern char* sFsckContext;
 extern char* sFsckUntrustedContext;
 
 // TODO remove this with better solution, b/64143519
-extern bool sSleepOnUnmount;
+extern std::atomic<bool> sSleepOnUnmount;
 
 std::string GetFuseMountPathForUser(userid_t user_id, const std::string& relative_upper_path);
 
@@ -75,14 +77,42 @@ int PrepareAppDirFromRoot(const std::string& path, const std::string& root, int
 status_t PrepareDir(const std::string& path, mode_t mode, uid_t uid, gid_t gid,
                     unsigned int attrs = 0);
 
+/*
+ * How far ForceUnmount() and friends had to escalate; kept in step with
+ * IVold::UNMOUNT_STAGE_*. Functions taking a KillStage* only ever raise it,
+ * so one value can be threaded through several calls.
+ */
+enum class KillStage {
+    kNone = 0,
+    kSigint = 1,
+    kSigterm = 2,
+    kSigkill = 3,
+    kFailed = 4,
+};
+
 /* Really unmounts the path, killing active processes along the way */
-status_t ForceUnmount(const std::string& path);
+status_t ForceUnmount(const std::string& path, KillStage* stage = nullptr);
+
+/*
+ * Unmounts every mount whose mount point passes |select|, children before
+ * parents. Independent subtrees are torn down concurrently, each through
+ * ForceUnmount(); a mount that still has unselected mounts on top of it can
+ * never be unmounted cleanly, so it is detached instead.
+ */
+status_t ForceUnmountMatching(const std::function<bool(const std::string& mountPoint)>& select);
+
+/*
+ * Lazily detaches the outermost mounts whose mount points pass |select|,
+ * taking everything on top of them along. For when there is no time left to
+ * wait for processes to let go.
+ */
+status_t DetachMatching(const std::function<bool(const std::string& mountPoint)>& select);
 
 /* Kills any processes using given path */
-status_t KillProcessesUsingPath(const std::string& path);
+status_t KillProcessesUsingPath(const std::string& path, KillStage* stage = nullptr);
 
 /* Kills any processes using given tmpfs mount prifix */
-status_t KillProcessesWithTmpfsMountPrefix(const std::string& path);
+status_t KillProcessesWithTmpfsMountPrefix(const std::string& path, KillStage* stage = nullptr);
 
 /* Creates bind mount from source to target */
 status_t BindMount(const std::string& source, const std::string& target);
@@ -114,6 +144,13 @@ status_t ForkExecvpTimeout(const std::vector<std::string>& args, std::chrono::se
 
 pid_t ForkExecvpAsync(const std::vector<std::string>& args, char* context = nullptr);
 
+/*
+ * Starts |args| in SELinux |context| without waiting for it. Its stdout goes
+ * to |stdoutFd|, or stdin, stdout and stderr are closed when that is -1.
+ */
+status_t SpawnProcess(const std::vector<std::string>& args, char* context, int stdoutFd,
+                      pid_t* pid);
+
 /* Gets block device size in bytes */
 status_t GetBlockDevSize(int fd, uint64_t* size);
 status_t GetBlockDevSize(const std::string& path, uint64_t* size);
@@ -134,7 +171,12 @@ status_t StrToHex(const KeyBuffer& str, KeyBuffer& hex);
 status_t NormalizeHex(const std::string& in, std::string& out);
 
 uint64_t GetFreeBytes(const std::string& path);
-uint64_t GetTreeBytes(const std::string& path);
+/*
+ * Allocated size of |path| and everything below it. Hard links within the
+ * tree are counted once, or once per link with |countEveryLink|, which is what
+ * a copy that doesn't preserve them will need.
+ */
+uint64_t GetTreeBytes(const std::string& path, bool countEveryLink = false);
 
 bool IsFilesystemSupported(const std::string& fsType);
 bool IsSdcardfsUsed();
@@ -31,6 +31,7 @@
 
 #include "Benchmark.h"
 #include "Checkpoint.h"
+#include "FileWaiter.h"
 #include "FsCrypt.h"
 #include "IdleMaint.h"
 #include "KeyStorage.h"
@@ -137,6 +138,7 @@ status_t VoldNativeService::dump(int fd, const Vector<String16>& /* args */) {
 
     ACQUIRE_LOCK;
     dprintf(fd, "vold is happy!\n");
+    FileWaiter::Instance()->dump(fd);
     return NO_ERROR;
 }
 
@@ -31,10 +31,14 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <map>
 
 #include <linux/kdev_t.h>
 
+#include <android-base/chrono_utils.h>
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
@@ -58,12 +62,16 @@
 #include "AppFuseUtil.h"
 #include "FsCrypt.h"
 #include "Loop.h"
+#include "NamespaceWorker.h"
 #include "NetlinkManager.h"
+#include "ProcSnapshot.h"
 #include "Process.h"
+#include "SystemCapabilities.h"
 #include "Utils.h"
 #include "VoldNativeService.h"
 #include "VoldUtil.h"
 #include "VolumeManager.h"
+#include "WorkStealingPool.h"
 #include "fs/Ext4.h"
 #include "fs/Vfat.h"
 #include "model/EmulatedVolume.h"
@@ -72,6 +80,8 @@
 #include "model/PublicVolume.h"
 #include "model/StubVolume.h"
 
+using namespace std::chrono_literals;
+
 using android::OK;
 using android::base::GetBoolProperty;
 using android::base::StartsWith;
@@ -182,6 +192,7 @@ int VolumeManager::start() {
     unmountAll();
 
     Loop::destroyAll();
+    Loop::warmPool();
 
     // Assume that we always have an emulated volume on internal
     // storage; the framework will decide if it should be mounted.
@@ -312,6 +323,12 @@ void VolumeManager::addDiskSource(const std::shared_ptr<DiskSource>& diskSource)
     mDiskSources.push_back(diskSource);
 }
 
+bool VolumeManager::matchesDiskSource(const std::string& sysPath) {
+    std::lock_guard<std::mutex> lock(mLock);
+    return std::any_of(mDiskSources.begin(), mDiskSources.end(),
+                       [&](const auto& source) { return source->matches(sysPath); });
+}
+
 std::shared_ptr<android::vold::Disk> VolumeManager::findDisk(const std::string& id) {
     for (auto disk : mDisks) {
         if (disk->getId() == id) {
@@ -517,22 +534,9 @@ int VolumeManager::onSecureKeyguardStateChanged(bool isShowing) {
     return 0;
 }
 
-// This code is executed after a fork so it's very important that the set of
-// methods we call here is strictly limited.
-//
-// TODO: Get rid of this guesswork altogether and instead exec a process
-// immediately after fork to do our bindding for us.
-static bool childProcess(const char* storageSource, const char* userSource, int nsFd,
-                         const char* name) {
-    if (setns(nsFd, CLONE_NEWNS) != 0) {
-        async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to setns for %s :%s", name,
-                              strerror(errno));
-        return false;
-    }
-
-    // NOTE: Inlined from vold::UnmountTree here to avoid using PLOG methods and
-    // to also protect against future changes that may cause issues across a
-    // fork.
+// Runs on the namespace worker, inside the app's mount namespace
+static bool remountStorage(const std::string& storageSource, const std::string& userSource,
+                           const std::string& name) {
     if (TEMP_FAILURE_RETRY(umount2("/storage/", MNT_DETACH)) < 0 && errno != EINVAL &&
         errno != ENOENT) {
         async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to unmount /storage/ :%s",
@@ -540,36 +544,43 @@ static bool childProcess(const char* storageSource, const char* userSource, int
         return false;
     }
 
-    if (TEMP_FAILURE_RETRY(mount(storageSource, "/storage", NULL, MS_BIND | MS_REC, NULL)) == -1) {
+    if (TEMP_FAILURE_RETRY(mount(storageSource.c_str(), "/storage", NULL, MS_BIND | MS_REC,
+                                 NULL)) == -1) {
         async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to mount %s for %s :%s",
-                              storageSource, name, strerror(errno));
+                              storageSource.c_str(), name.c_str(), strerror(errno));
         return false;
     }
 
     if (TEMP_FAILURE_RETRY(mount(NULL, "/storage", NULL, MS_REC | MS_SLAVE, NULL)) == -1) {
         async_safe_format_log(ANDROID_LOG_ERROR, "vold",
-                              "Failed to set MS_SLAVE to /storage for %s :%s", name,
+                              "Failed to set MS_SLAVE to /storage for %s :%s", name.c_str(),
                               strerror(errno));
         return false;
     }
 
-    if (TEMP_FAILURE_RETRY(mount(userSource, "/storage/self", NULL, MS_BIND, NULL)) == -1) {
+    if (TEMP_FAILURE_RETRY(mount(userSource.c_str(), "/storage/self", NULL, MS_BIND, NULL)) ==
+        -1) {
         async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to mount %s for %s :%s",
-                              userSource, name, strerror(errno));
+                              userSource.c_str(), name.c_str(), strerror(errno));
         return false;
     }
 
     return true;
 }
 
-// Fork the process and remount storage
-bool forkAndRemountChild(uid_t uid, pid_t pid, int nsFd, const char* name, void* params) {
-    int32_t mountMode = *static_cast<int32_t*>(params);
+struct RemountBatch {
+    int32_t mountMode;
+    std::vector<unique_fd> nsFds;
+    std::vector<android::vold::NamespaceWorker::Job> jobs;
+};
+
+// Queue a remount of storage in the process' namespace
+bool queueRemountChild(uid_t uid, pid_t pid, int nsFd, const char* name, void* params) {
+    auto batch = static_cast<RemountBatch*>(params);
     std::string userSource;
     std::string storageSource;
-    pid_t child;
     // Need to fix these paths to account for when sdcardfs is gone
-    switch (mountMode) {
+    switch (batch->mountMode) {
         case VoldNativeService::REMOUNT_MODE_NONE:
             return true;
         case VoldNativeService::REMOUNT_MODE_DEFAULT:
@@ -582,26 +593,41 @@ bool forkAndRemountChild(uid_t uid, pid_t pid, int nsFd, const char* name, void*
         case VoldNativeService::REMOUNT_MODE_PASS_THROUGH:
             return true;
         default:
-            PLOG(ERROR) << "Unknown mode " << std::to_string(mountMode);
+            PLOG(ERROR) << "Unknown mode " << std::to_string(batch->mountMode);
             return false;
     }
     LOG(DEBUG) << "Remounting " << uid << " as " << storageSource;
 
-    // Fork a child to mount user-specific symlink helper into place
-    userSource = StringPrintf("/mnt/user/%d", multiuser_get_user_id(uid));
-    if (!(child = fork())) {
-        if (childProcess(storageSource.c_str(), userSource.c_str(), nsFd, name)) {
-            _exit(0);
-        } else {
-            _exit(1);
-        }
+    // The scan closes its fd once we return
+    unique_fd batchNsFd(fcntl(nsFd, F_DUPFD_CLOEXEC, 0));
+    if (batchNsFd == -1) {
+        PLOG(ERROR) << "Failed to dup namespace of " << name;
+        return false;
     }
 
-    if (child == -1) {
-        PLOG(ERROR) << "Failed to fork";
+    // Mount user-specific symlink helper into place
+    userSource = StringPrintf("/mnt/user/%d", multiuser_get_user_id(uid));
+    auto op = [storageSource, userSource, name = std::string(name)]() {
+        return remountStorage(storageSource, userSource, name);
+    };
+    batch->jobs.push_back({batchNsFd.get(), op});
+    batch->nsFds.push_back(std::move(batchNsFd));
+    return true;
+}
+
+// Remount storage for every app process matching |uid| and |userId|, as one
+// batch on the namespace worker rather than a fork per process
+bool remountProcesses(uid_t uid, userid_t userId, int32_t mountMode) {
+    RemountBatch batch{.mountMode = mountMode};
+    if (!scanProcProcesses(uid, userId, queueRemountChild, &batch)) {
+        return false;
+    }
+    auto results = android::vold::NamespaceWorker::Instance()->run(std::move(batch.jobs));
+    auto failed = std::count(results.begin(), results.end(), false);
+    if (failed > 0) {
+        LOG(ERROR) << "Failed to remount storage in " << failed << " of " << results.size()
+                   << " processes";
         return false;
-    } else {
-        TEMP_FAILURE_RETRY(waitpid(child, nullptr, 0));
     }
     return true;
 }
@@ -611,60 +637,37 @@ bool forkAndRemountChild(uid_t uid, pid_t pid, int nsFd, const char* name, void*
 // 2). If input uid is 0 or it matches the process uid
 // 3). If userId is not -1 or userId matches the process userId
 bool scanProcProcesses(uid_t uid, userid_t userId, ScanProcCallback callback, void* params) {
-    DIR* dir;
-    struct dirent* de;
-    std::string rootName;
-    std::string pidName;
-    std::string exeName;
-    int pidFd;
-    int nsFd;
-    struct stat sb;
-
-    if (!(dir = opendir("/proc"))) {
-        async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to opendir");
+    auto snapshot = android::vold::ProcSnapshot::Get();
+    if (!snapshot) {
+        async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to scan /proc");
         return false;
     }
 
     // Figure out root namespace to compare against below
-    if (!android::vold::Readlinkat(dirfd(dir), "1/ns/mnt", &rootName)) {
+    const auto* init = snapshot->find(1);
+    if (init == nullptr || init->mountNs == 0) {
         async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to read root namespace");
-        closedir(dir);
         return false;
     }
 
     async_safe_format_log(ANDROID_LOG_INFO, "vold", "Start scanning all processes");
     // Poke through all running PIDs look for apps running as UID
-    while ((de = readdir(dir))) {
-        pid_t pid;
-        if (de->d_type != DT_DIR) continue;
-        if (!android::base::ParseInt(de->d_name, &pid)) continue;
-
-        pidFd = -1;
-        nsFd = -1;
-
-        pidFd = openat(dirfd(dir), de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
-        if (pidFd < 0) {
-            goto next;
-        }
-        if (fstat(pidFd, &sb) != 0) {
-            async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to stat %s", de->d_name);
-            goto next;
+    for (const auto& process : snapshot->processes()) {
+        if (uid != 0 && process->uid != uid) {
+            continue;
         }
-        if (uid != 0 && sb.st_uid != uid) {
-            goto next;
-        }
-        if (userId != static_cast<userid_t>(-1) && multiuser_get_user_id(sb.st_uid) != userId) {
-            goto next;
+        if (userId != static_cast<userid_t>(-1) && multiuser_get_user_id(process->uid) != userId) {
+            continue;
         }
 
         // Matches so far, but refuse to touch if in root namespace
-        if (!android::vold::Readlinkat(pidFd, "ns/mnt", &pidName)) {
+        if (process->mountNs == 0) {
             async_safe_format_log(ANDROID_LOG_ERROR, "vold",
-                    "Failed to read namespacefor %s", de->d_name);
-            goto next;
+                    "Failed to read namespacefor %d", process->pid);
+            continue;
         }
-        if (rootName == pidName) {
-            goto next;
+        if (process->mountNs == init->mountNs) {
+            continue;
         }
 
         // Some early native processes have mount namespaces that are different
@@ -674,45 +677,34 @@ bool scanProcProcesses(uid_t uid, userid_t userId, ScanProcCallback callback, vo
         // init. Filter out such processes by skipping if a process is a
         // non-Java process whose UID is < AID_APP_START. (The UID condition
         // is required to not filter out child processes spawned by apps.)
-        if (!android::vold::Readlinkat(pidFd, "exe", &exeName)) {
-            goto next;
+        if (process->exe.empty()) {
+            continue;
         }
-        if (!StartsWith(exeName, "/system/bin/app_process") && sb.st_uid < AID_APP_START) {
-            goto next;
+        if (!StartsWith(process->exe, "/system/bin/app_process") &&
+            process->uid < AID_APP_START) {
+            continue;
         }
 
-        // We purposefully leave the namespace open across the fork
-        // NOLINTNEXTLINE(android-cloexec-open): Deliberately not O_CLOEXEC
-        nsFd = openat(pidFd, "ns/mnt", O_RDONLY);
+        int nsFd = process->openAt("ns/mnt", O_RDONLY | O_CLOEXEC);
         if (nsFd < 0) {
             async_safe_format_log(ANDROID_LOG_ERROR, "vold",
-                    "Failed to open namespace for %s", de->d_name);
-            goto next;
+                    "Failed to open namespace for %d", process->pid);
+            continue;
         }
 
-        if (!callback(sb.st_uid, pid, nsFd, de->d_name, params)) {
+        std::string name = std::to_string(process->pid);
+        if (!callback(process->uid, process->pid, nsFd, name.c_str(), params)) {
             async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed in callback");
         }
-
-    next:
         close(nsFd);
-        close(pidFd);
     }
-    closedir(dir);
     async_safe_format_log(ANDROID_LOG_INFO, "vold", "Finished scanning all processes");
     return true;
 }
 
 // In each app's namespace, unmount obb and data dirs
-static bool umountStorageDirs(int nsFd, const char* android_data_dir, const char* android_obb_dir,
+static bool umountStorageDirs(const char* android_data_dir, const char* android_obb_dir,
         int uid, const char* targets[], int size) {
-    // This code is executed after a fork so it's very important that the set of
-    // methods we call here is strictly limited.
-    if (setns(nsFd, CLONE_NEWNS) != 0) {
-        async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to setns %s", strerror(errno));
-        return false;
-    }
-
     // Unmount of Android/data/foo needs to be done before Android/data below.
     bool result = true;
     for (int i = 0; i < size; i++) {
@@ -742,15 +734,8 @@ static bool umountStorageDirs(int nsFd, const char* android_data_dir, const char
 
 // In each app's namespace, mount tmpfs on obb and data dir, and bind mount obb and data
 // package dirs.
-static bool remountStorageDirs(int nsFd, const char* android_data_dir, const char* android_obb_dir,
+static bool remountStorageDirs(const char* android_data_dir, const char* android_obb_dir,
         int uid, const char* sources[], const char* targets[], int size) {
-    // This code is executed after a fork so it's very important that the set of
-    // methods we call here is strictly limited.
-    if (setns(nsFd, CLONE_NEWNS) != 0) {
-        async_safe_format_log(ANDROID_LOG_ERROR, "vold", "Failed to setns %s", strerror(errno));
-        return false;
-    }
-
     // Mount tmpfs on Android/data and Android/obb
     if (TEMP_FAILURE_RETRY(mount("tmpfs", android_data_dir, "tmpfs",
             MS_NOSUID | MS_NODEV | MS_NOEXEC, "uid=0,gid=0,mode=0751")) == -1) {
@@ -798,8 +783,8 @@ static std::string getStorageDirTarget(userid_t userId, std::string dirName,
             userId, dirName.c_str(), packageName.c_str());
 }
 
-// Fork the process and remount / unmount app data and obb dirs
-bool VolumeManager::forkAndRemountStorage(int uid, int pid, bool doUnmount,
+// Remount / unmount app data and obb dirs in the namespace of |pid|
+bool VolumeManager::remountAppStorage(int uid, int pid, bool doUnmount,
                                           const std::vector<std::string>& packageNames) {
     userid_t userId = multiuser_get_user_id(uid);
     std::string mnt_path = StringPrintf("/proc/%d/ns/mnt", pid);
@@ -852,44 +837,19 @@ bool VolumeManager::forkAndRemountStorage(int uid, int pid, bool doUnmount,
     snprintf(android_data_dir, PATH_MAX, "/storage/emulated/%d/Android/data", userId);
     snprintf(android_obb_dir, PATH_MAX, "/storage/emulated/%d/Android/obb", userId);
 
-    pid_t child;
-    // Fork a child to mount Android/obb android Android/data dirs, as we don't want it to affect
-    // original vold process mount namespace.
-    if (!(child = fork())) {
+    // Mount Android/obb android Android/data dirs from the namespace worker, as we don't want it
+    // to affect original vold process mount namespace.
+    auto op = [&]() {
         if (doUnmount) {
-            if (umountStorageDirs(nsFd, android_data_dir, android_obb_dir, uid,
-                    targets_cstr, size)) {
-                _exit(0);
-            } else {
-                _exit(1);
-            }
-        } else {
-            if (remountStorageDirs(nsFd, android_data_dir, android_obb_dir, uid,
-                    sources_cstr, targets_cstr, size)) {
-                _exit(0);
-            } else {
-                _exit(1);
-            }
+            return umountStorageDirs(android_data_dir, android_obb_dir, uid, targets_cstr, size);
         }
-    }
-
-    if (child == -1) {
-        PLOG(ERROR) << "Failed to fork";
+        return remountStorageDirs(android_data_dir, android_obb_dir, uid, sources_cstr,
+                                  targets_cstr, size);
+    };
+    if (!android::vold::NamespaceWorker::Instance()->run(nsFd, op)) {
+        LOG(ERROR) << "Failed to " << (doUnmount ? "unmount" : "remount")
+                   << " storage dirs for pid " << pid;
         return false;
-    } else {
-        int status;
-        if (TEMP_FAILURE_RETRY(waitpid(child, &status, 0)) == -1) {
-            PLOG(ERROR) << "Failed to waitpid: " << child;
-            return false;
-        }
-        if (!WIFEXITED(status)) {
-            PLOG(ERROR) << "Process did not exit normally, status: " << status;
-            return false;
-        }
-        if (WEXITSTATUS(status)) {
-            PLOG(ERROR) << "Process exited with code: " << WEXITSTATUS(status);
-            return false;
-        }
     }
     return true;
 }
@@ -909,7 +869,7 @@ int VolumeManager::handleAppStorageDirs(int uid, int pid,
         }
     }
     if (fuseMounted) {
-        forkAndRemountStorage(uid, pid, doUnmount, packageNames);
+        remountAppStorage(uid, pid, doUnmount, packageNames);
     }
     return 0;
 }
@@ -918,21 +878,99 @@ int VolumeManager::abortFuse() {
     return android::vold::AbortFuseConnections();
 }
 
-int VolumeManager::reset() {
-    // Tear down all existing disks/volumes and start from a blank slate so
-    // newly connected framework hears all events.
+// How long reset() and shutdown() wait for volumes to go away on their own
+// before detaching whatever is left
+static constexpr std::chrono::milliseconds kTeardownDeadline = 10s;
+
+// Mount points owned by volumes, as opposed to the rest of /mnt
+static bool IsVolumeMountPoint(const std::string& path) {
+    return (StartsWith(path, "/mnt/") &&
+#ifdef __ANDROID_DEBUGGABLE__
+            !StartsWith(path, "/mnt/scratch") &&
+#endif
+            !StartsWith(path, "/mnt/vendor") && !StartsWith(path, "/mnt/product") &&
+            !StartsWith(path, "/mnt/installer") && !StartsWith(path, "/mnt/androidwritable")) ||
+           StartsWith(path, "/storage/");
+}
+
+void VolumeManager::teardownVolumes() {
+    ATRACE_NAME("VolumeManager::teardownVolumes()");
+    android::base::Timer total;
+
+    // Disks go first: their public volumes are served by the same FUSE daemon
+    // that tearing down the primary emulated volumes may kill. Within a disk,
+    // unmount() already destroys stacked volumes before the one below them.
+    std::vector<std::pair<std::string, std::function<void()>>> diskTasks;
+    for (const auto& disk : mDisks) {
+        diskTasks.push_back({disk->getId(), [disk] { disk->destroy(); }});
+    }
+
+    // Users sharing storage bind mount each other's volumes, so they go together
+    std::map<userid_t, std::vector<std::shared_ptr<VolumeBase>>> groups;
     for (const auto& vol : mInternalEmulatedVolumes) {
-        vol->destroy();
+        userid_t userId = vol->getMountUserId();
+        userid_t sharedUserId = getSharedStorageUser(userId);
+        groups[sharedUserId != USER_UNKNOWN ? sharedUserId : userId].push_back(vol);
+    }
+    std::vector<std::pair<std::string, std::function<void()>>> emulatedTasks;
+    for (const auto& group : groups) {
+        auto vols = group.second;
+        auto destroyGroup = [vols] {
+            for (const auto& vol : vols) vol->destroy();
+        };
+        auto name = StringPrintf("emulated volumes of user %d", group.first);
+        emulatedTasks.push_back({name, destroyGroup});
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + kTeardownDeadline;
+    bool detached = false;
+    bool sleepOnUnmount = android::vold::sSleepOnUnmount;
+    for (auto* tasks : {&diskTasks, &emulatedTasks}) {
+        if (tasks->empty()) continue;
+        android::vold::WorkStealingPool pool(
+                std::min(tasks->size(), android::vold::WorkStealingPool::DefaultThreads()));
+        for (const auto& task : *tasks) {
+            pool.submit([&task] {
+                android::base::Timer timer;
+                task.second();
+                LOG(INFO) << "Tore down " << task.first << " in " << timer;
+            });
+        }
+
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (!detached && !pool.waitFor(std::max(remaining, 0ms))) {
+            // Out of time: stop waiting for processes, unblock anything stuck
+            // on a FUSE daemon and drop the mounts from under the stragglers
+            LOG(WARNING) << "Volume teardown missed its " << kTeardownDeadline.count()
+                         << "ms deadline; detaching remaining mounts";
+            android::vold::sSleepOnUnmount = false;
+            abortFuse();
+            android::vold::DetachMatching(IsVolumeMountPoint);
+            detached = true;
+        }
+        pool.wait();
     }
+    android::vold::sSleepOnUnmount = sleepOnUnmount;
+
     mInternalEmulatedVolumes.clear();
+    LOG(INFO) << "Tore down all volumes in " << total << (detached ? " (detached)" : "");
+}
+
+int VolumeManager::reset() {
+    // Kernel modules may have come and gone since we last looked
+    android::vold::SystemCapabilities::Refresh();
+
+    // Tear down all existing disks/volumes and start from a blank slate so
+    // newly connected framework hears all events.
+    teardownVolumes();
 
-    // Destroy and recreate all disks except that StubVolume disks are just
-    // destroyed and removed from both mDisks and mPendingDisks.
+    // Recreate all disks except that StubVolume disks are just removed from
+    // both mDisks and mPendingDisks.
     // StubVolumes are managed from outside Android (e.g. from Chrome OS) and
     // their disk recreation on reset events should be handled from outside by
     // calling createStubVolume() again.
     for (const auto& disk : mDisks) {
-        disk->destroy();
         if (!disk->isStub()) {
             disk->create();
         }
@@ -958,14 +996,8 @@ int VolumeManager::shutdown() {
         return 0;  // already shutdown
     }
     android::vold::sSleepOnUnmount = false;
-    for (const auto& vol : mInternalEmulatedVolumes) {
-        vol->destroy();
-    }
-    for (const auto& disk : mDisks) {
-        disk->destroy();
-    }
+    teardownVolumes();
 
-    mInternalEmulatedVolumes.clear();
     mDisks.clear();
     mPendingDisks.clear();
     android::vold::sSleepOnUnmount = true;
@@ -987,36 +1019,7 @@ int VolumeManager::unmountAll() {
 
     // Worst case we might have some stale mounts lurking around, so
     // force unmount those just to be safe.
-    FILE* fp = setmntent("/proc/mounts", "re");
-    if (fp == NULL) {
-        PLOG(ERROR) << "Failed to open /proc/mounts";
-        return -errno;
-    }
-
-    // Some volumes can be stacked on each other, so force unmount in
-    // reverse order to give us the best chance of success.
-    std::list<std::string> toUnmount;
-    mntent* mentry;
-    while ((mentry = getmntent(fp)) != NULL) {
-        auto test = std::string(mentry->mnt_dir);
-        if ((StartsWith(test, "/mnt/") &&
-#ifdef __ANDROID_DEBUGGABLE__
-             !StartsWith(test, "/mnt/scratch") &&
-#endif
-             !StartsWith(test, "/mnt/vendor") && !StartsWith(test, "/mnt/product") &&
-             !StartsWith(test, "/mnt/installer") && !StartsWith(test, "/mnt/androidwritable")) ||
-            StartsWith(test, "/storage/")) {
-            toUnmount.push_front(test);
-        }
-    }
-    endmntent(fp);
-
-    for (const auto& path : toUnmount) {
-        LOG(DEBUG) << "Tearing down stale mount " << path;
-        android::vold::ForceUnmount(path);
-    }
-
-    return 0;
+    return android::vold::ForceUnmountMatching(IsVolumeMountPoint);
 }
 
 int VolumeManager::ensureAppDirsCreated(const std::vector<std::string>& paths, int32_t appUid) {
@@ -78,6 +78,8 @@ class VolumeManager {
     };
 
     void addDiskSource(const std::shared_ptr<DiskSource>& diskSource);
+    /* Whether a disk at |sysPath|, a uevent DEVPATH, would be picked up */
+    bool matchesDiskSource(const std::string& sysPath);
 
     std::shared_ptr<android::vold::Disk> findDisk(const std::string& id);
     std::shared_ptr<android::vold::VolumeBase> findVolume(const std::string& id);
@@ -132,7 +134,7 @@ class VolumeManager {
     int updateVirtualDisk();
     int setDebug(bool enable);
 
-    bool forkAndRemountStorage(int uid, int pid, bool doUnmount,
+    bool remountAppStorage(int uid, int pid, bool doUnmount,
         const std::vector<std::string>& packageNames);
 
     static VolumeManager* Instance();
@@ -209,6 +211,9 @@ class VolumeManager {
     void createEmulatedVolumesForUser(userid_t userId);
     void destroyEmulatedVolumesForUser(userid_t userId);
 
+    /* Destroys every disk and internal emulated volume, independent ones concurrently */
+    void teardownVolumes();
+
     void handleDiskAdded(const std::shared_ptr<android::vold::Disk>& disk);
     void handleDiskChanged(dev_t device);
     void handleDiskRemoved(dev_t device);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WorkStealingPool.h"
+
+#include <android-base/logging.h>
+
+#include <algorithm>
+
+namespace android {
+namespace vold {
+
+// Identifies the pool and deque owned by the current thread, if any, so that
+// nested submissions stay local to the worker that produced them.
+static thread_local WorkStealingPool* tPool = nullptr;
+static thread_local size_t tIndex = 0;
+
+size_t WorkStealingPool::DefaultThreads() {
+    // Flash devices stop scaling well beyond a handful of outstanding
+    // metadata operations, so there is no point in using every core.
+    return std::clamp<size_t>(std::thread::hardware_concurrency(), 2, 8);
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; i++) {
+        mQueues.emplace_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        mThreads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+    }
+    mWorkAvailable.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(Task task) {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (tPool == this) {
+            index = tIndex;
+        } else {
+            index = mNextQueue++ % mQueues.size();
+        }
+        // Counted before the push so a concurrent pop can never underflow
+        mQueued++;
+        mPending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mQueues[index]->lock);
+        mQueues[index]->tasks.emplace_back(std::move(task));
+    }
+    mWorkAvailable.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(mLock);
+    mIdle.wait(lock, [this] { return mPending == 0; });
+}
+
+bool WorkStealingPool::waitFor(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mLock);
+    return mIdle.wait_for(lock, timeout, [this] { return mPending == 0; });
+}
+
+bool WorkStealingPool::tryPop(size_t index, Task* task) {
+    {
+        auto& own = *mQueues[index];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty()) {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < mQueues.size(); i++) {
+        auto& victim = *mQueues[(index + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t index) {
+    tPool = this;
+    tIndex = index;
+
+    while (true) {
+        Task task;
+        if (tryPop(index, &task)) {
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+                mQueued--;
+            }
+            task();
+            task = nullptr;
+            std::lock_guard<std::mutex> lock(mLock);
+            if (--mPending == 0) {
+                mIdle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mLock);
+        mWorkAvailable.wait(lock, [this] { return mStopping || mQueued > 0; });
+        if (mStopping && mQueued == 0) {
+            return;
+        }
+    }
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_WORK_STEALING_POOL_H
+#define ANDROID_VOLD_WORK_STEALING_POOL_H
+
+#include <android-base/macros.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace vold {
+
+/*
+ * Fixed-size thread pool used to fan filesystem tree walks out across cores.
+ *
+ * Every worker owns a deque. Tasks submitted from a worker go to the back of
+ * its own deque and are popped LIFO, which keeps a walk depth-first and bounds
+ * the number of directories held open. Idle workers steal from the front of
+ * other deques, which tends to hand them the largest remaining subtrees.
+ */
+class WorkStealingPool {
+  public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(size_t threads = DefaultThreads());
+    ~WorkStealingPool();
+
+    /* Queues a task; safe to call from inside a running task */
+    void submit(Task task);
+
+    /* Blocks until every submitted task, including nested ones, has run */
+    void wait();
+
+    /* As wait(), but gives up after |timeout|; returns true when idle */
+    bool waitFor(std::chrono::milliseconds timeout);
+
+    size_t size() const { return mThreads.size(); }
+
+    /* Number of workers used when the caller has no better estimate */
+    static size_t DefaultThreads();
+
+  private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    void run(size_t index);
+    bool tryPop(size_t index, Task* task);
+
+    std::vector<std::unique_ptr<Queue>> mQueues;
+    std::vector<std::thread> mThreads;
+
+    std::mutex mLock;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mIdle;
+    // Tasks sitting in a deque, and tasks that are queued or running.
+    size_t mQueued = 0;
+    size_t mPending = 0;
+    size_t mNextQueue = 0;
+    bool mStopping = false;
+
+    DISALLOW_COPY_AND_ASSIGN(WorkStealingPool);
+};
+
+}  // namespace vold
+}  // namespace android
+
+#endif
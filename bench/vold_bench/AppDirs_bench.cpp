@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeDelete.h"
+#include "Utils.h"
+#include "VoldBench.h"
+
+#include <benchmark/benchmark.h>
+#include <cutils/fs.h>
+#include <private/android_filesystem_config.h>
+#include <private/android_projectid_config.h>
+
+#include <sys/stat.h>
+
+namespace android {
+namespace vold {
+
+// ensureAppDirsCreated() at boot or after a user switch: Android/data/<pkg>
+// and Android/obb/<pkg> for every installed package on a fresh volume. The
+// volume lookup in front of PrepareAppDirFromRoot() is left out.
+static const mode_t kAppDirMode = S_IRWXU | S_IRWXG | S_ISGID;
+
+static std::string AppDirsRoot() {
+    std::string root = bench::ScratchDir() + "/appdirs";
+    TreeDelete(root, 0).run();
+    mkdir(root.c_str(), 0771);
+    return root;
+}
+
+static std::string Package(int i) {
+    return "com.example.package" + std::to_string(i);
+}
+
+// The path based walk PrepareAppDirFromRoot() did before it moved to open
+// directory fds, for a single level below Android/data or Android/obb
+static int LegacyPrepareAppDir(const std::string& root, const char* appDir, const std::string& pkg,
+                               uid_t uid, gid_t gid, long projectId) {
+    mode_t androidMode = S_IRWXU | S_IRWXG | S_IXOTH | S_ISGID;
+    if (fs_prepare_dir((root + "/Android/").c_str(), androidMode, AID_MEDIA_RW, AID_MEDIA_RW) ||
+        fs_prepare_dir((root + "/Android/data/").c_str(), androidMode, AID_MEDIA_RW,
+                       AID_EXT_DATA_RW) ||
+        fs_prepare_dir((root + "/Android/obb/").c_str(), androidMode, AID_MEDIA_RW,
+                       AID_EXT_OBB_RW) ||
+        fs_prepare_dir((root + "/Android/media/").c_str(), androidMode, AID_MEDIA_RW,
+                       AID_MEDIA_RW)) {
+        return -1;
+    }
+    SetDefaultAcl(root + "/Android/obb/", androidMode, AID_MEDIA_RW, AID_EXT_OBB_RW, {});
+
+    std::string path = root + appDir + pkg + "/";
+    if (fs_prepare_dir(path.c_str(), kAppDirMode, uid, gid)) return -1;
+    if (!IsSdcardfsUsed() && SetQuotaProjectId(path, projectId)) return -1;
+    if (SetDefaultAcl(path, kAppDirMode, uid, gid, {uid})) return -1;
+    if (!IsSdcardfsUsed() && SetQuotaInherit(path)) return -1;
+    return 0;
+}
+
+static void BM_LegacyPrepareAppDirs(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::string root = AppDirsRoot();
+        state.ResumeTiming();
+        for (int i = 0; i < state.range(0); i++) {
+            uid_t uid = AID_APP_START + i;
+            if (LegacyPrepareAppDir(root, "/Android/data/", Package(i), uid, AID_EXT_DATA_RW,
+                                    uid - AID_APP_START + PROJECT_ID_EXT_DATA_START) ||
+                LegacyPrepareAppDir(root, "/Android/obb/", Package(i), uid, AID_EXT_OBB_RW,
+                                    uid - AID_APP_START + PROJECT_ID_EXT_OBB_START)) {
+                state.SkipWithError("Failed to prepare app dirs");
+                return;
+            }
+        }
+    }
+}
+BENCHMARK(BM_LegacyPrepareAppDirs)->Arg(100)->Arg(500)->Unit(benchmark::kMillisecond);
+
+static void BM_PrepareAppDirFromRoot(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::string root = AppDirsRoot();
+        state.ResumeTiming();
+        for (int i = 0; i < state.range(0); i++) {
+            int uid = AID_APP_START + i;
+            if (PrepareAppDirFromRoot(root + "/Android/data/" + Package(i), root, uid, false) ||
+                PrepareAppDirFromRoot(root + "/Android/obb/" + Package(i), root, uid, false)) {
+                state.SkipWithError("Failed to prepare app dirs");
+                return;
+            }
+        }
+    }
+}
+BENCHMARK(BM_PrepareAppDirFromRoot)->Arg(100)->Arg(500)->Unit(benchmark::kMillisecond);
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FileWaiter.h"
+#include "Loop.h"
+#include "VoldBench.h"
+#include "fs/Vfat.h"
+
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <functional>
+#include <thread>
+
+using namespace std::chrono_literals;
+using android::base::StringPrintf;
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+
+// Roughly the size of a game's main expansion file
+static constexpr unsigned long kObbSectors = 64 * 1024 * 1024 / 512;
+
+static const std::string& ObbImage() {
+    static const std::string path = [] {
+        std::string image = bench::ScratchDir() + "/main.obb";
+        std::string device;
+        if (Loop::createImageFile(image.c_str(), kObbSectors) != 0 ||
+            Loop::create(image, device) != 0) {
+            return std::string();
+        }
+        status_t res = vfat::Format(device, 0);
+        Loop::destroyByDevice(device.c_str());
+        return res == OK ? image : std::string();
+    }();
+    return path;
+}
+
+static const std::string& MountPoint() {
+    static const std::string path = [] {
+        std::string dir = bench::ScratchDir() + "/obb";
+        mkdir(dir.c_str(), 0700);
+        return dir;
+    }();
+    return path;
+}
+
+// What Loop::create() did before LOOP_CONFIGURE and the device pool
+static int LegacyCreate(const std::string& target, std::string* device) {
+    unique_fd ctl_fd(open("/dev/loop-control", O_RDWR | O_CLOEXEC));
+    int num = ioctl(ctl_fd.get(), LOOP_CTL_GET_FREE);
+    if (num == -1) return -errno;
+    *device = StringPrintf("/dev/block/loop%d", num);
+
+    unique_fd target_fd(open(target.c_str(), O_RDWR | O_CLOEXEC));
+    if (target_fd.get() == -1) return -errno;
+    if (FileWaiter::Instance()->waitFor(*device, 2s) != OK) return -ENOENT;
+    unique_fd device_fd(open(device->c_str(), O_RDWR | O_CLOEXEC));
+    if (device_fd.get() == -1) return -errno;
+    if (ioctl(device_fd.get(), LOOP_SET_FD, target_fd.get()) == -1) return -errno;
+
+    struct loop_info64 li = {};
+    strlcpy((char*)li.lo_crypt_name, "vold:", LO_NAME_SIZE);
+    if (ioctl(device_fd.get(), LOOP_SET_STATUS64, &li) == -1) return -errno;
+    return 0;
+}
+
+// One OBB mount and unmount, as ObbVolume does them
+static void MountObb(benchmark::State& state, const std::function<int(std::string*)>& create) {
+    const std::string& image = ObbImage();
+    if (image.empty()) {
+        state.SkipWithError("Failed to create OBB image");
+        return;
+    }
+    for (auto _ : state) {
+        std::string device;
+        if (create(&device) != 0) {
+            state.SkipWithError("Failed to create loop device");
+            break;
+        }
+        if (vfat::Mount(device, MountPoint(), true, false, true, 0, 0, 0227, false) != OK) {
+            state.SkipWithError("Failed to mount OBB");
+            Loop::destroyByDevice(device.c_str());
+            break;
+        }
+        umount2(MountPoint().c_str(), MNT_DETACH);
+        Loop::destroyByDevice(device.c_str());
+
+        // Give the pool time to refill, as it would between two app launches
+        state.PauseTiming();
+        std::this_thread::sleep_for(10ms);
+        state.ResumeTiming();
+    }
+}
+
+static void BM_LegacyObbMount(benchmark::State& state) {
+    MountObb(state, [](std::string* device) { return LegacyCreate(ObbImage(), device); });
+}
+BENCHMARK(BM_LegacyObbMount)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+static void BM_ObbMount(benchmark::State& state) {
+    Loop::Options options;
+    options.directIo = state.range(0);
+    Loop::warmPool();
+    MountObb(state, [&](std::string* device) {
+        return Loop::create(ObbImage(), options, *device);
+    });
+}
+BENCHMARK(BM_ObbMount)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Utils.h"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+
+namespace android {
+namespace vold {
+
+// Stands in for vold's heap: touched so that every page is mapped and has
+// to be dealt with by fork()
+class Ballast {
+  public:
+    explicit Ballast(size_t mib) : mSize(mib << 20), mData(new char[mSize]) {
+        memset(mData.get(), 1, mSize);
+    }
+
+  private:
+    size_t mSize;
+    std::unique_ptr<char[]> mData;
+};
+
+static const std::vector<std::string> kTrue = {"true"};
+
+// What ForkExecvpAsync() did before it moved to posix_spawn()
+static pid_t LegacyFork() {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("true", "true", nullptr);
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+static void BM_LegacyFork(benchmark::State& state) {
+    Ballast ballast(state.range(0));
+    for (auto _ : state) {
+        pid_t pid = LegacyFork();
+        if (pid == -1) state.SkipWithError("fork failed");
+        waitpid(pid, nullptr, 0);
+    }
+}
+BENCHMARK(BM_LegacyFork)->Arg(0)->Arg(64)->Arg(256)->Arg(1024)->UseRealTime();
+
+static void BM_Spawn(benchmark::State& state) {
+    Ballast ballast(state.range(0));
+    for (auto _ : state) {
+        pid_t pid = ForkExecvpAsync(kTrue);
+        if (pid == -1) state.SkipWithError("spawn failed");
+        waitpid(pid, nullptr, 0);
+    }
+}
+BENCHMARK(BM_Spawn)->Arg(0)->Arg(64)->Arg(256)->Arg(1024)->UseRealTime();
+
+}  // namespace vold
+}  // namespace android
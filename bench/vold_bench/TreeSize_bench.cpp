@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TreeSize.h"
+#include "VoldBench.h"
+
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace android {
+namespace vold {
+
+// 100 x 100 directories of 100 empty files each: a million files, shaped
+// roughly like the media and app data trees MoveStorage has to size
+static constexpr int kFanout = 100;
+
+static const std::string& SizeTree() {
+    static const std::string path = bench::MakeTree("size", kFanout, kFanout, kFanout);
+    return path;
+}
+
+// The single threaded readdir() + fstatat() walk GetTreeBytes() used to do
+static int64_t LegacyDirSize(int dfd) {
+    int64_t size = 0;
+    DIR* d = fdopendir(dfd);
+    if (d == nullptr) {
+        close(dfd);
+        return 0;
+    }
+    struct dirent* de;
+    struct stat s;
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+        if (fstatat(dfd, de->d_name, &s, AT_SYMLINK_NOFOLLOW) == 0) {
+            size += s.st_blocks * 512;
+        }
+        if (de->d_type == DT_DIR) {
+            int subfd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (subfd >= 0) size += LegacyDirSize(subfd);
+        }
+    }
+    closedir(d);
+    return size;
+}
+
+static void BM_LegacyDirSize(benchmark::State& state) {
+    const std::string& path = SizeTree();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+                LegacyDirSize(open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+    }
+}
+BENCHMARK(BM_LegacyDirSize)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_TreeSize(benchmark::State& state) {
+    const std::string& path = SizeTree();
+    for (auto _ : state) {
+        TreeSize size(path, state.range(0));
+        if (size.run() != OK) state.SkipWithError("TreeSize failed");
+        benchmark::DoNotOptimize(size.bytes());
+    }
+}
+BENCHMARK(BM_TreeSize)->Arg(1)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace vold
+}  // namespace android
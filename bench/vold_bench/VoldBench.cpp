@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VoldBench.h"
+#include "TreeDelete.h"
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using android::base::unique_fd;
+
+namespace android {
+namespace vold {
+namespace bench {
+
+const std::string& ScratchDir() {
+    static const std::string path = [] {
+        std::string dir = "/data/local/tmp/vold_bench";
+        TreeDelete(dir, 0).run();
+        PCHECK(mkdir(dir.c_str(), 0700) == 0) << dir;
+        return dir;
+    }();
+    return path;
+}
+
+std::string MakeTree(const std::string& name, int dirs, int subdirs, int files) {
+    std::string root = ScratchDir() + "/" + name;
+    PCHECK(mkdir(root.c_str(), 0700) == 0) << root;
+    LOG(INFO) << "Generating " << dirs * subdirs * files << " files in " << root;
+
+    for (int i = 0; i < dirs; i++) {
+        std::string dir = root + "/" + std::to_string(i);
+        PCHECK(mkdir(dir.c_str(), 0700) == 0) << dir;
+        for (int j = 0; j < subdirs; j++) {
+            std::string subdir = dir + "/" + std::to_string(j);
+            PCHECK(mkdir(subdir.c_str(), 0700) == 0) << subdir;
+            unique_fd fd(open(subdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            PCHECK(fd != -1) << subdir;
+            for (int k = 0; k < files; k++) {
+                unique_fd file(openat(fd, std::to_string(k).c_str(),
+                                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+                PCHECK(file != -1) << subdir << "/" << k;
+            }
+        }
+    }
+    sync();
+    return root;
+}
+
+}  // namespace bench
+}  // namespace vold
+}  // namespace android
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    android::vold::TreeDelete(android::vold::bench::ScratchDir(), 0).run();
+    return 0;
+}
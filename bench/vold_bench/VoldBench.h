@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_VOLD_BENCH_VOLD_BENCH_H
+#define ANDROID_VOLD_BENCH_VOLD_BENCH_H
+
+#include <string>
+
+namespace android {
+namespace vold {
+namespace bench {
+
+/* Scratch directory for generated fixtures; removed when the run ends */
+const std::string& ScratchDir();
+
+/*
+ * Creates ScratchDir()/|name| holding |dirs| directories of |subdirs|
+ * directories of |files| empty files, and returns its path.
+ */
+std::string MakeTree(const std::string& name, int dirs, int subdirs, int files);
+
+}  // namespace bench
+}  // namespace vold
+}  // namespace android
+
+#endif
@@ -22,12 +22,17 @@
 #include "VoldNativeService.h"
 #include "VoldUtil.h"
 #include "VolumeManager.h"
+#include "WorkStealingPool.h"
 #include "model/Disk.h"
 #include "sehandle.h"
 
+#include <android-base/chrono_utils.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/klog.h>
 #include <hidl/HidlTransportSupport.h>
 #include <utils/Trace.h>
@@ -42,6 +47,13 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 typedef struct vold_configs {
     bool has_adoptable : 1;
@@ -52,6 +64,7 @@ typedef struct vold_configs {
 
 static int process_config(VolumeManager* vm, VoldConfigs* configs);
 static void coldboot(const char* path);
+static void coldboot_disks(VolumeManager* vm, const char* path);
 static void parse_args(int argc, char** argv);
 static void VoldLogger(android::base::LogId log_buffer_id, android::base::LogSeverity severity,
                        const char* tag, const char* file, unsigned int line, const char* message);
@@ -146,7 +159,11 @@ int main(int argc, char** argv) {
     // Do coldboot here so it won't block booting,
     // also the cold boot is needed in case we have flash drive
     // connected before Vold launched
-    coldboot("/sys/block");
+    if (android::base::GetBoolProperty("vold.coldboot.full", false)) {
+        coldboot("/sys/block");
+    } else {
+        coldboot_disks(vm, "/sys/block");
+    }
 
     ATRACE_END();
 
@@ -224,6 +241,54 @@ static void coldboot(const char* path) {
     }
 }
 
+// Replays add events only for the disks a DiskSource will pick up; vold
+// ignores partitions and unmatched disks, and ueventd has already seen them
+static void coldboot_disks(VolumeManager* vm, const char* path) {
+    ATRACE_NAME("coldboot_disks");
+    android::base::Timer timer;
+
+    std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(path), closedir);
+    if (!dir) {
+        PLOG(ERROR) << "Failed to open " << path;
+        return;
+    }
+
+    std::vector<std::string> uevents;
+    size_t scanned = 0;
+    struct dirent* de;
+    while ((de = readdir(dir.get()))) {
+        if (de->d_name[0] == '.') continue;
+        scanned++;
+
+        // Entries link to the device under /sys/devices, which is what
+        // DEVPATH holds minus the /sys
+        std::string entry = StringPrintf("%s/%s", path, de->d_name);
+        std::string sysPath;
+        if (!android::base::Realpath(entry, &sysPath) ||
+            !android::base::StartsWith(sysPath, "/sys/")) {
+            continue;
+        }
+        if (vm->matchesDiskSource(sysPath.substr(strlen("/sys")))) {
+            uevents.push_back(entry + "/uevent");
+        }
+    }
+
+    std::atomic<size_t> triggered = 0;
+    if (!uevents.empty()) {
+        android::vold::WorkStealingPool pool(
+                std::min(uevents.size(), android::vold::WorkStealingPool::DefaultThreads()));
+        for (const auto& uevent : uevents) {
+            pool.submit([&uevent, &triggered] {
+                android::base::unique_fd fd(open(uevent.c_str(), O_WRONLY | O_CLOEXEC));
+                if (fd.get() != -1 && write(fd.get(), "add\n", 4) == 4) triggered++;
+            });
+        }
+        pool.wait();
+    }
+    LOG(INFO) << "Coldboot triggered " << triggered << " uevents for " << scanned
+              << " block devices in " << timer;
+}
+
 static int process_config(VolumeManager* vm, VoldConfigs* configs) {
     ATRACE_NAME("process_config");
 
@@ -17,6 +17,7 @@
 #include "Disk.h"
 #include "FsCrypt.h"
 #include "PrivateVolume.h"
+#include "ProcessExecutor.h"
 #include "PublicVolume.h"
 #include "Utils.h"
 #include "VolumeBase.h"
@@ -29,6 +30,7 @@
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <fscrypt/fscrypt.h>
 
 #include <fcntl.h>
@@ -49,7 +51,6 @@ namespace android {
 namespace vold {
 
 static const char* kSgdiskPath = "/system/bin/sgdisk";
-static const char* kSgdiskToken = " \t\n";
 
 static const char* kSysfsLoopMaxMinors = "/sys/module/loop/parameters/max_part";
 static const char* kSysfsMmcMaxMinorsDeprecated = "/sys/module/mmcblk/parameters/perdev_minors";
@@ -80,12 +81,6 @@ static const char* kGptBasicData = "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7";
 static const char* kGptAndroidMeta = "19A710A2-B3CA-11E4-B026-10604B889DCF";
 static const char* kGptAndroidExpand = "193D1EA4-B3CA-11E4-B075-10604B889DCF";
 
-enum class Table {
-    kUnknown,
-    kMbr,
-    kGpt,
-};
-
 static bool isNvmeBlkDevice(unsigned int major, const std::string& sysPath) {
     return sysPath.find("nvme") != std::string::npos && major >= kMajorBlockDynamicMin &&
            major <= kMajorBlockDynamicMax;
@@ -97,7 +92,8 @@ Disk::Disk(const std::string& eventPath, dev_t device, const std::string& nickna
       mNickname(nickname),
       mFlags(flags),
       mCreated(false),
-      mJustPartitioned(false) {
+      mJustPartitioned(false),
+      mScanGeneration(0) {
     mId = StringPrintf("disk:%u,%u", major(device), minor(device));
     mEventPath = eventPath;
     mSysPath = StringPrintf("/sys/%s", eventPath.c_str());
@@ -232,6 +228,7 @@ void Disk::destroyAllVolumes() {
         vol->destroy();
     }
     mVolumes.clear();
+    mTableCrc.reset();
 }
 
 status_t Disk::readMetadata() {
@@ -326,89 +323,100 @@ status_t Disk::readPartitions() {
         return -ENOTSUP;
     }
 
-    destroyAllVolumes();
-
-    // Parse partition table
-
-    std::vector<std::string> cmd;
-    cmd.push_back(kSgdiskPath);
-    cmd.push_back("--android-dump");
-    cmd.push_back(mDevPath);
-
-    std::vector<std::string> output;
-    status_t res = ForkExecvp(cmd, &output);
-    if (res != OK) {
-        LOG(WARNING) << "sgdisk failed to scan " << mDevPath;
-
-        auto listener = VolumeManager::Instance()->getListener();
-        if (listener) listener->onDiskScanned(getId());
-
-        mJustPartitioned = false;
-        return res;
+    // Most tables are read and checked right here in a read or two
+    PartitionTable table;
+    android::base::unique_fd fd(open(mDevPath.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.get() == -1) {
+        PLOG(WARNING) << "Failed to open " << mDevPath;
+    } else if (ReadPartitionTable(fd.get(), &table) != OK) {
+        table.type = PartitionTable::Type::kUnknown;
+    }
+    fd.reset();
+
+    if (table.type != PartitionTable::Type::kUnknown) {
+        // A change event that leaves a GPT as it was (e.g. a filesystem label
+        // being written) keeps the existing volumes mounted. Its header holds
+        // the disk GUID; an MBR could be identical on another card swapped
+        // into the same reader.
+        bool isGpt = table.type == PartitionTable::Type::kGpt;
+        if (isGpt && !mJustPartitioned && mTableCrc == table.crc) {
+            LOG(DEBUG) << mId << " partition table unchanged; keeping volumes";
+            auto listener = VolumeManager::Instance()->getListener();
+            if (listener) listener->onDiskScanned(getId());
+            return OK;
+        }
+        destroyAllVolumes();
+        ++mScanGeneration;
+        if (isGpt) mTableCrc = table.crc;
+        applyPartitions(table, maxMinors);
+        return OK;
     }
 
-    Table table = Table::kUnknown;
-    bool foundParts = false;
-    for (const auto& line : output) {
-        auto split = android::base::Split(line, kSgdiskToken);
-        auto it = split.begin();
-        if (it == split.end()) continue;
-
-        if (*it == "DISK") {
-            if (++it == split.end()) continue;
-            if (*it == "mbr") {
-                table = Table::kMbr;
-            } else if (*it == "gpt") {
-                table = Table::kGpt;
-            } else {
-                LOG(WARNING) << "Invalid partition table " << *it;
-                continue;
-            }
-        } else if (*it == "PART") {
-            foundParts = true;
-
-            if (++it == split.end()) continue;
-            int i = 0;
-            if (!android::base::ParseInt(*it, &i, 1, maxMinors)) {
-                LOG(WARNING) << "Invalid partition number " << *it;
-                continue;
-            }
-            dev_t partDevice = makedev(major(mDevice), minor(mDevice) + i);
-
-            if (table == Table::kMbr) {
-                if (++it == split.end()) continue;
-                int type = 0;
-                if (!android::base::ParseInt("0x" + *it, &type)) {
-                    LOG(WARNING) << "Invalid partition type " << *it;
-                    continue;
-                }
+    destroyAllVolumes();
 
-                switch (type) {
-                    case 0x06:  // FAT16
-                    case 0x07:  // HPFS/NTFS/exFAT
-                    case 0x0b:  // W95 FAT32 (LBA)
-                    case 0x0c:  // W95 FAT32 (LBA)
-                    case 0x0e:  // W95 FAT16 (LBA)
-                        createPublicVolume(partDevice);
-                        break;
+    // Anything else goes to sgdisk, run off this thread, so that several
+    // disks showing up at once (e.g. a hub full of USB drives) are scanned in
+    // parallel rather than one after another under the VolumeManager lock.
+    // The results are applied under that lock once sgdisk is done, unless
+    // the disk was destroyed or rescanned in the meantime.
+    ProcessExecutor::Command cmd;
+    cmd.args.push_back(kSgdiskPath);
+    cmd.args.push_back("--android-dump");
+    cmd.args.push_back(mDevPath);
+
+    uint64_t generation = ++mScanGeneration;
+    std::weak_ptr<Disk> weakDisk = weak_from_this();
+    ProcessExecutor::Instance()->submit(
+            std::move(cmd), [weakDisk, generation, maxMinors](ProcessExecutor::Result result) {
+                std::lock_guard<std::mutex> lock(VolumeManager::Instance()->getLock());
+                auto disk = weakDisk.lock();
+                if (!disk || !disk->mCreated || disk->mScanGeneration != generation) return;
+                if (result.status != OK) {
+                    LOG(WARNING) << "sgdisk failed to scan " << disk->mDevPath;
+
+                    auto listener = VolumeManager::Instance()->getListener();
+                    if (listener) listener->onDiskScanned(disk->getId());
+
+                    disk->mJustPartitioned = false;
+                    return;
                 }
-            } else if (table == Table::kGpt) {
-                if (++it == split.end()) continue;
-                auto typeGuid = *it;
-                if (++it == split.end()) continue;
-                auto partGuid = *it;
+                PartitionTable table;
+                ParseSgdiskOutput(result.output, &table);
+                disk->applyPartitions(table, maxMinors);
+            });
+    return OK;
+}
 
-                if (android::base::EqualsIgnoreCase(typeGuid, kGptBasicData)) {
+void Disk::applyPartitions(const PartitionTable& table, int maxMinors) {
+    for (const auto& partition : table.partitions) {
+        if (partition.number < 1 || partition.number > maxMinors) {
+            LOG(WARNING) << "Invalid partition number " << partition.number;
+            continue;
+        }
+        dev_t partDevice = makedev(major(mDevice), minor(mDevice) + partition.number);
+
+        if (table.type == PartitionTable::Type::kMbr) {
+            switch (partition.mbrType) {
+                case 0x06:  // FAT16
+                case 0x07:  // HPFS/NTFS/exFAT
+                case 0x0b:  // W95 FAT32 (LBA)
+                case 0x0c:  // W95 FAT32 (LBA)
+                case 0x0e:  // W95 FAT16 (LBA)
                     createPublicVolume(partDevice);
-                } else if (android::base::EqualsIgnoreCase(typeGuid, kGptAndroidExpand)) {
-                    createPrivateVolume(partDevice, partGuid);
-                }
+                    break;
+            }
+        } else if (table.type == PartitionTable::Type::kGpt) {
+            if (android::base::EqualsIgnoreCase(partition.typeGuid, kGptBasicData)) {
+                createPublicVolume(partDevice);
+            } else if (android::base::EqualsIgnoreCase(partition.typeGuid, kGptAndroidExpand)) {
+                createPrivateVolume(partDevice, partition.partGuid);
             }
         }
     }
 
     // Ugly last ditch effort, treat entire disk as partition
-    if (table == Table::kUnknown || !foundParts) {
+    if (table.type == PartitionTable::Type::kUnknown ||
+        table.type == PartitionTable::Type::kNone || table.partitions.empty()) {
         LOG(WARNING) << mId << " has unknown partition table; trying entire device";
 
         std::string fsType;
@@ -424,7 +432,6 @@ status_t Disk::readPartitions() {
     if (listener) listener->onDiskScanned(getId());
 
     mJustPartitioned = false;
-    return OK;
 }
 
 void Disk::initializePartition(std::shared_ptr<StubVolume> vol) {
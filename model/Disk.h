@@ -17,12 +17,15 @@
 #ifndef ANDROID_VOLD_DISK_H
 #define ANDROID_VOLD_DISK_H
 
+#include "PartitionTable.h"
 #include "StubVolume.h"
 #include "Utils.h"
 #include "VolumeBase.h"
 
 #include <utils/Errors.h>
 
+#include <memory>
+#include <optional>
 #include <vector>
 
 namespace android {
@@ -36,7 +39,7 @@ class VolumeBase;
  * Knows how to create volumes based on the partition tables found, and also
  * how to repartition itself.
  */
-class Disk {
+class Disk : public std::enable_shared_from_this<Disk> {
   public:
     Disk(const std::string& eventPath, dev_t device, const std::string& nickname, int flags);
     virtual ~Disk();
@@ -82,6 +85,7 @@ class Disk {
     status_t destroy();
 
     status_t readMetadata();
+    /* Starts scanning the partition table; volumes are created once it completes */
     status_t readPartitions();
     void initializePartition(std::shared_ptr<StubVolume> vol);
 
@@ -116,6 +120,10 @@ class Disk {
     bool mCreated;
     /* Flag that we just partitioned and should format all volumes */
     bool mJustPartitioned;
+    /* Bumped by every partition scan, so that stale results are dropped */
+    uint64_t mScanGeneration;
+    /* CRC of the GPT the current volumes were created from */
+    std::optional<uint32_t> mTableCrc;
 
     void createPublicVolume(dev_t device);
     void createPrivateVolume(dev_t device, const std::string& partGuid);
@@ -123,6 +131,8 @@ class Disk {
 
     void destroyAllVolumes();
 
+    void applyPartitions(const PartitionTable& table, int maxMinors);
+
     int getMaxMinors();
 
     DISALLOW_COPY_AND_ASSIGN(Disk);
@@ -278,7 +278,7 @@ status_t EmulatedVolume::unmountFuseBindMounts() {
         std::string appObbDir(StringPrintf("%s/%d/Android/obb", getPath().c_str(), userId));
         // Here we assume obb/data dirs is mounted as tmpfs, then it must be caused by
         // app data isolation.
-        KillProcessesWithTmpfsMountPrefix(appObbDir);
+        KillProcessesWithTmpfsMountPrefix(appObbDir, unmountStage());
     }
 
     // Always unmount data and obb dirs as they are mounted to lowerfs for speeding up access.
@@ -311,10 +311,10 @@ status_t EmulatedVolume::unmountSdcardFs() {
         return OK;
     }
 
-    ForceUnmount(mSdcardFsDefault);
-    ForceUnmount(mSdcardFsRead);
-    ForceUnmount(mSdcardFsWrite);
-    ForceUnmount(mSdcardFsFull);
+    ForceUnmount(mSdcardFsDefault, unmountStage());
+    ForceUnmount(mSdcardFsRead, unmountStage());
+    ForceUnmount(mSdcardFsWrite, unmountStage());
+    ForceUnmount(mSdcardFsFull, unmountStage());
 
     rmdir(mSdcardFsDefault.c_str());
     rmdir(mSdcardFsRead.c_str());
@@ -495,9 +495,9 @@ status_t EmulatedVolume::doUnmount() {
         // processes using files from this particular user.
         std::string user_path(StringPrintf("%s/%d", getPath().c_str(), getMountUserId()));
         LOG(INFO) << "Killing all processes referencing " << user_path;
-        KillProcessesUsingPath(user_path);
+        KillProcessesUsingPath(user_path, unmountStage());
     } else {
-        KillProcessesUsingPath(getPath());
+        KillProcessesUsingPath(getPath(), unmountStage());
     }
 
     if (mFuseMounted) {
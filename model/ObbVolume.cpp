@@ -22,6 +22,7 @@
 
 #include <android-base/logging.h>
 #include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
 #include <cutils/fs.h>
 #include <private/android_filesystem_config.h>
 
@@ -32,6 +33,7 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 using android::base::StringPrintf;
 
@@ -47,8 +49,24 @@ ObbVolume::ObbVolume(int id, const std::string& sourcePath, gid_t ownerGid)
 
 ObbVolume::~ObbVolume() {}
 
+// Bytes per sector from the FAT boot sector, or 0 if it doesn't look valid.
+// Using it as the loop block size keeps direct I/O aligned with vfat's reads.
+static uint32_t GetFatSectorSize(const std::string& path) {
+    android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    uint8_t bytes[2];
+    if (fd.get() == -1 || pread(fd.get(), bytes, sizeof(bytes), 11) != sizeof(bytes)) return 0;
+    uint32_t size = bytes[0] | (bytes[1] << 8);
+    if (size < 512 || size > 4096 || (size & (size - 1)) != 0) return 0;
+    return size;
+}
+
 status_t ObbVolume::doCreate() {
-    if (Loop::create(mSourcePath, mLoopPath)) {
+    // The vfat mount on top already caches OBB contents; going through the
+    // page cache of the backing file as well would keep them twice
+    Loop::Options options;
+    options.directIo = true;
+    options.blockSize = GetFatSectorSize(mSourcePath);
+    if (Loop::create(mSourcePath, options, mLoopPath)) {
         PLOG(ERROR) << getId() << " failed to create loop";
         return -1;
     }
@@ -84,8 +102,8 @@ status_t ObbVolume::doMount() {
 status_t ObbVolume::doUnmount() {
     auto path = getPath();
 
-    KillProcessesUsingPath(path);
-    ForceUnmount(path);
+    KillProcessesUsingPath(path, unmountStage());
+    ForceUnmount(path, unmountStage());
     rmdir(path.c_str());
 
     return OK;
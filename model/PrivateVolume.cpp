@@ -202,7 +202,7 @@ void PrivateVolume::doPostMount() {
 }
 
 status_t PrivateVolume::doUnmount() {
-    ForceUnmount(mPath);
+    ForceUnmount(mPath, unmountStage());
 
     if (TEMP_FAILURE_RETRY(rmdir(mPath.c_str()))) {
         PLOG(ERROR) << getId() << " failed to rmdir mount point " << mPath;
@@ -301,7 +301,7 @@ status_t PublicVolume::doUnmount() {
     // the FUSE process first, most file system operations will return
     // ENOTCONN until the unmount completes. This is an exotic and unusual
     // error code and might cause broken behaviour in applications.
-    KillProcessesUsingPath(getPath());
+    KillProcessesUsingPath(getPath(), unmountStage());
 
     if (mFuseMounted) {
         // Use UUID as stable name, if available
@@ -320,7 +320,7 @@ status_t PublicVolume::doUnmount() {
             }
             LOG(INFO) << "Removing Public Volume Bind Mount for: " << started_user;
             auto mountPath = GetFuseMountPathForUser(started_user, stableName);
-            ForceUnmount(mountPath);
+            ForceUnmount(mountPath, unmountStage());
             rmdir(mountPath.c_str());
         }
 
@@ -332,13 +332,13 @@ status_t PublicVolume::doUnmount() {
         mFuseMounted = false;
     }
 
-    ForceUnmount(kAsecPath);
+    ForceUnmount(kAsecPath, unmountStage());
 
     if (mUseSdcardFs) {
-        ForceUnmount(mSdcardFsDefault);
-        ForceUnmount(mSdcardFsRead);
-        ForceUnmount(mSdcardFsWrite);
-        ForceUnmount(mSdcardFsFull);
+        ForceUnmount(mSdcardFsDefault, unmountStage());
+        ForceUnmount(mSdcardFsRead, unmountStage());
+        ForceUnmount(mSdcardFsWrite, unmountStage());
+        ForceUnmount(mSdcardFsFull, unmountStage());
 
         rmdir(mSdcardFsDefault.c_str());
         rmdir(mSdcardFsRead.c_str());
@@ -351,13 +351,13 @@ status_t PublicVolume::doUnmount() {
         mSdcardFsFull.clear();
     }
 
-    if (ForceUnmount(mRawPath) != 0){
+    if (ForceUnmount(mRawPath, unmountStage()) != 0){
         umount2(mRawPath.c_str(),MNT_DETACH);
         PLOG(INFO) << "use umount lazy if force unmount fail";
     }
     if(rmdir(mRawPath.c_str()) != 0) {
         PLOG(INFO) << "rmdir mRawPath=" << mRawPath << " fail";
-        KillProcessesUsingPath(getPath());
+        KillProcessesUsingPath(getPath(), unmountStage());
     }
     mRawPath.clear();
 
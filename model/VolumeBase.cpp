@@ -38,7 +38,8 @@ VolumeBase::VolumeBase(Type type)
       mMountUserId(USER_UNKNOWN),
       mCreated(false),
       mState(State::kUnmounted),
-      mSilent(false) {}
+      mSilent(false),
+      mUnmountStage(KillStage::kNone) {}
 
 VolumeBase::~VolumeBase() {
     CHECK(!mCreated);
@@ -255,7 +256,12 @@ status_t VolumeBase::unmount() {
     }
     mVolumes.clear();
 
+    mUnmountStage = KillStage::kNone;
     status_t res = doUnmount();
+    auto listener = getListener();
+    if (listener) {
+        listener->onVolumeUnmountStage(getId(), static_cast<int32_t>(mUnmountStage));
+    }
     setState(State::kUnmounted);
     return res;
 }
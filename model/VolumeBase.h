@@ -140,6 +140,9 @@ class VolumeBase {
     android::sp<android::os::IVoldListener> getListener() const;
     android::sp<android::os::IVoldMountCallback> getMountCallback() const;
 
+    /* Escalation reached while unmounting, reported once doUnmount() returns */
+    KillStage* unmountStage() { return &mUnmountStage; }
+
   private:
     /* ID that uniquely references volume while alive */
     std::string mId;
@@ -164,6 +167,8 @@ class VolumeBase {
     /* Flag indicating that volume should emit no events */
     bool mSilent;
     android::sp<android::os::IVoldMountCallback> mMountCallback;
+    /* Furthest ForceUnmount() and friends escalated in the current unmount */
+    KillStage mUnmountStage;
 
     /* Volumes stacked on top of this volume */
     std::list<std::shared_ptr<VolumeBase>> mVolumes;
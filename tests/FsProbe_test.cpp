@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../FsProbe.h"
+
+namespace android {
+namespace vold {
+
+// The expected values are what "blkid -s TYPE -s UUID -s LABEL" prints for
+// the same images padded out to a full device.
+
+static const uint8_t kUuid[16] = {0x3e, 0x6b, 0x1f, 0x0a, 0x52, 0x7c, 0x4d, 0x19,
+                                  0x9a, 0x2e, 0x81, 0x5f, 0xc4, 0x07, 0xd3, 0x66};
+static const char* kUuidString = "3e6b1f0a-527c-4d19-9a2e-815fc407d366";
+
+static void Put16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void Put32(uint8_t* p, uint32_t v) {
+    Put16(p, v);
+    Put16(p + 2, v >> 16);
+}
+
+static void Put64(uint8_t* p, uint64_t v) {
+    Put32(p, v);
+    Put32(p + 4, v >> 32);
+}
+
+static void PutUtf16(uint8_t* p, const std::u16string& s) {
+    for (size_t i = 0; i < s.size(); i++) Put16(p + 2 * i, s[i]);
+}
+
+// An ext4 superblock as mke2fs writes it, with the features picking the type
+static std::vector<uint8_t> MakeExt(uint32_t compat, uint32_t incompat, uint32_t roCompat) {
+    std::vector<uint8_t> image(64 * 1024);
+    uint8_t* sb = image.data() + 1024;
+    Put32(sb + 0x00, 16);         // s_inodes_count
+    Put32(sb + 0x04, 64);         // s_blocks_count
+    Put32(sb + 0x14, 1);          // s_first_data_block
+    Put32(sb + 0x20, 8192);       // s_blocks_per_group
+    Put32(sb + 0x28, 16);         // s_inodes_per_group
+    Put16(sb + 0x38, 0xEF53);     // s_magic
+    Put16(sb + 0x3A, 1);          // s_state
+    Put32(sb + 0x4C, 1);          // s_rev_level
+    Put32(sb + 0x54, 11);         // s_first_ino
+    Put16(sb + 0x58, 256);        // s_inode_size
+    Put32(sb + 0x5C, compat);
+    Put32(sb + 0x60, incompat);
+    Put32(sb + 0x64, roCompat);
+    memcpy(sb + 0x68, kUuid, sizeof(kUuid));
+    memcpy(sb + 0x78, "userdata", 8);
+    return image;
+}
+
+// A FAT32 volume whose boot sector still carries the label it was formatted
+// with, while the root directory has the one it was renamed to
+static std::vector<uint8_t> MakeFat32() {
+    const uint32_t reserved = 32, fatSize = 8;
+    std::vector<uint8_t> image(1024 * 512);
+    uint8_t* bs = image.data();
+    memcpy(bs, "\xEB\x58\x90" "mkfs.fat", 11);
+    Put16(bs + 11, 512);
+    bs[13] = 1;                   // Sectors per cluster
+    Put16(bs + 14, reserved);
+    bs[16] = 2;                   // FATs
+    bs[21] = 0xF8;                // Media
+    Put32(bs + 32, image.size() / 512);
+    Put32(bs + 36, fatSize);
+    Put32(bs + 44, 2);            // Root cluster
+    bs[66] = 0x29;
+    Put32(bs + 67, 0x1A2B3C4D);
+    memcpy(bs + 71, "OLDLABEL   FAT32   ", 19);
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+
+    uint8_t* fat = image.data() + reserved * 512;
+    Put32(fat, 0x0FFFFFF8);
+    Put32(fat + 4, 0x0FFFFFFF);
+    Put32(fat + 8, 0x0FFFFFFF);
+    memcpy(fat + fatSize * 512, fat, 12);
+
+    uint8_t* root = image.data() + (reserved + 2 * fatSize) * 512;
+    memcpy(root, "SDCARD     ", 11);
+    root[11] = 0x08;              // Volume ID
+    return image;
+}
+
+// A FAT16 volume formatted without a label
+static std::vector<uint8_t> MakeFat16() {
+    std::vector<uint8_t> image(8400 * 512);
+    uint8_t* bs = image.data();
+    memcpy(bs, "\xEB\x3C\x90" "mkfs.fat", 11);
+    Put16(bs + 11, 512);
+    bs[13] = 1;
+    Put16(bs + 14, 1);
+    bs[16] = 2;
+    Put16(bs + 17, 512);          // Root entries
+    Put16(bs + 19, image.size() / 512);
+    bs[21] = 0xF8;
+    Put16(bs + 22, 33);           // Sectors per FAT
+    bs[38] = 0x29;
+    Put32(bs + 39, 0x00C0FFEE);
+    memcpy(bs + 43, "NO NAME    FAT16   ", 19);
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+
+    uint8_t* fat = image.data() + 512;
+    Put16(fat, 0xFFF8);
+    Put16(fat + 2, 0xFFFF);
+    memcpy(fat + 33 * 512, fat, 4);
+    return image;
+}
+
+static uint32_t ExfatBootChecksum(const uint8_t* region) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 11 * 512; i++) {
+        // VolumeFlags and PercentInUse change at runtime and are left out
+        if (i == 106 || i == 107 || i == 112) continue;
+        sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + region[i];
+    }
+    return sum;
+}
+
+static std::vector<uint8_t> MakeExfat(const std::u16string& label) {
+    const uint32_t fatOffset = 24, fatLength = 8, heapOffset = 32, rootCluster = 4;
+    std::vector<uint8_t> image(256 * 512);
+    uint8_t* bs = image.data();
+    memcpy(bs, "\xEB\x76\x90" "EXFAT   ", 11);
+    Put64(bs + 72, image.size() / 512);
+    Put32(bs + 80, fatOffset);
+    Put32(bs + 84, fatLength);
+    Put32(bs + 88, heapOffset);
+    Put32(bs + 92, image.size() / 512 - heapOffset);
+    Put32(bs + 96, rootCluster);
+    Put32(bs + 100, 0x5E1F00D5);
+    Put16(bs + 104, 0x0100);      // Revision 1.0
+    bs[108] = 9;                  // 512 byte sectors
+    bs[109] = 0;                  // One sector per cluster
+    bs[110] = 1;                  // FATs
+    bs[111] = 0x80;
+    bs[510] = 0x55;
+    bs[511] = 0xAA;
+    for (int sector = 1; sector <= 8; sector++) {
+        image[sector * 512 + 510] = 0x55;
+        image[sector * 512 + 511] = 0xAA;
+    }
+    uint32_t checksum = ExfatBootChecksum(bs);
+    for (size_t off = 0; off < 512; off += 4) Put32(bs + 11 * 512 + off, checksum);
+
+    Put32(image.data() + fatOffset * 512 + rootCluster * 4, 0xFFFFFFFF);
+    uint8_t* root = image.data() + (heapOffset + rootCluster - 2) * 512;
+    root[0] = 0x83;               // Volume label
+    root[1] = label.size();
+    PutUtf16(root + 2, label);
+    return image;
+}
+
+static std::vector<uint8_t> MakeF2fs(const std::u16string& label) {
+    std::vector<uint8_t> image(64 * 1024);
+    uint8_t* sb = image.data() + 1024;
+    Put32(sb, 0xF2F52010);
+    Put16(sb + 4, 1);             // major_ver
+    Put16(sb + 6, 16);            // minor_ver
+    Put32(sb + 8, 9);             // log_sectorsize
+    Put32(sb + 12, 3);            // log_sectors_per_block
+    Put32(sb + 16, 12);           // log_blocksize
+    Put32(sb + 20, 9);            // log_blocks_per_seg
+    Put32(sb + 24, 1);            // segs_per_sec
+    Put32(sb + 28, 1);            // secs_per_zone
+    Put64(sb + 36, 16384);        // block_count
+    memcpy(sb + 108, kUuid, sizeof(kUuid));
+    PutUtf16(sb + 124, label);
+    return image;
+}
+
+static FsProbeResult Probe(const std::vector<uint8_t>& image) {
+    FsProbeResult result;
+    EXPECT_EQ(OK, ProbeFilesystem(image.data(), image.size(), &result));
+    return result;
+}
+
+static void ExpectProbe(const std::vector<uint8_t>& image, const std::string& type,
+                        const std::string& uuid, const std::string& label) {
+    FsProbeResult result = Probe(image);
+    EXPECT_EQ(type, result.type);
+    EXPECT_EQ(uuid, result.uuid);
+    EXPECT_EQ(label, result.label);
+}
+
+class FsProbeTest : public testing::Test {};
+
+TEST_F(FsProbeTest, Ext4) {
+    // filetype, extents, 64bit and flex_bg; sparse_super, large_file, huge_file
+    ExpectProbe(MakeExt(0x3C, 0x2C2, 0x0B), "ext4", kUuidString, "userdata");
+}
+
+TEST_F(FsProbeTest, Ext3AndExt2) {
+    ExpectProbe(MakeExt(0x3C, 0x2, 0x3), "ext3", kUuidString, "userdata");
+    ExpectProbe(MakeExt(0x38, 0x2, 0x3), "ext2", kUuidString, "userdata");
+}
+
+TEST_F(FsProbeTest, F2fs) {
+    ExpectProbe(MakeF2fs(u"data"), "f2fs", kUuidString, "data");
+    ExpectProbe(MakeF2fs(u"été \U0001F4BE"), "f2fs", kUuidString,
+                "\xc3\xa9t\xc3\xa9 \xf0\x9f\x92\xbe");
+}
+
+TEST_F(FsProbeTest, Vfat) {
+    // The root directory entry wins over the stale boot sector label
+    ExpectProbe(MakeFat32(), "vfat", "1A2B-3C4D", "SDCARD");
+    // "NO NAME" in the boot sector means there is no label at all
+    ExpectProbe(MakeFat16(), "vfat", "00C0-FFEE", "");
+}
+
+TEST_F(FsProbeTest, Exfat) {
+    ExpectProbe(MakeExfat(u"Photos"), "exfat", "5E1F-00D5", "Photos");
+    ExpectProbe(MakeExfat(u"Café"), "exfat", "5E1F-00D5", "Caf\xc3\xa9");
+}
+
+TEST_F(FsProbeTest, ExtWinsOverStaleFatBootSector) {
+    auto image = MakeExt(0x3C, 0x2C2, 0x0B);
+    auto fat = MakeFat32();
+    memcpy(image.data(), fat.data(), 512);
+    ExpectProbe(image, "ext4", kUuidString, "userdata");
+}
+
+TEST_F(FsProbeTest, Unrecognized) {
+    FsProbeResult result;
+    std::vector<uint8_t> zeros(64 * 1024);
+    EXPECT_EQ(-EINVAL, ProbeFilesystem(zeros.data(), zeros.size(), &result));
+    EXPECT_TRUE(result.type.empty());
+
+    // An external ext journal is not a filesystem
+    auto journal = MakeExt(0x0, 0x8, 0x0);
+    EXPECT_EQ(-EINVAL, ProbeFilesystem(journal.data(), journal.size(), &result));
+
+    // Truncated images read as zeros past the end
+    auto exfat = MakeExfat(u"Photos");
+    EXPECT_EQ(OK, ProbeFilesystem(exfat.data(), 512, &result));
+    EXPECT_EQ("exfat", result.type);
+    EXPECT_EQ("", result.label);
+    EXPECT_EQ(-EINVAL, ProbeFilesystem(exfat.data(), 64, &result));
+}
+
+}  // namespace vold
+}  // namespace android
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/sysmacros.h>
+
+#include <string>
+#include <vector>
+
+#include "../MountTree.h"
+
+namespace android {
+namespace vold {
+
+class MountTreeTest : public testing::Test {
+  protected:
+    std::vector<std::string> postOrderPoints(const MountTree& tree, size_t root) {
+        std::vector<std::string> points;
+        for (size_t i : tree.postOrder(root)) points.push_back(tree.mounts()[i].mountPoint);
+        return points;
+    }
+};
+
+TEST_F(MountTreeTest, ParsesFields) {
+    MountTree tree;
+    tree.parse(
+            "22 1 253:5 /media/0 /storage/emulated\\040dir rw,nosuid shared:7 master:2 - "
+            "sdcardfs /data\\134media rw,gid=1015\n");
+
+    ASSERT_EQ(1u, tree.mounts().size());
+    const auto& mount = tree.mounts()[0];
+    EXPECT_EQ(22, mount.id);
+    EXPECT_EQ(1, mount.parentId);
+    EXPECT_EQ(makedev(253, 5), mount.dev);
+    EXPECT_EQ("/media/0", mount.root);
+    EXPECT_EQ("/storage/emulated dir", mount.mountPoint);
+    EXPECT_EQ("sdcardfs", mount.fsType);
+    EXPECT_EQ("/data\\media", mount.source);
+    // Its parent isn't in this namespace
+    EXPECT_EQ(MountTree::kNoParent, mount.parent);
+}
+
+TEST_F(MountTreeTest, SkipsMalformedLines) {
+    MountTree tree;
+    tree.parse(
+            "\n"
+            "garbage\n"
+            "x 1 0:1 / / rw - tmpfs tmpfs rw\n"
+            "2 1 0:1 / / rw tmpfs tmpfs rw\n"
+            "3 1 0:1 / /mnt rw - tmpfs\n"
+            "4 1 0:1 / /ok rw - tmpfs tmpfs rw\n");
+
+    ASSERT_EQ(1u, tree.mounts().size());
+    EXPECT_EQ("/ok", tree.mounts()[0].mountPoint);
+}
+
+TEST_F(MountTreeTest, SelfParentedRoot) {
+    MountTree tree;
+    tree.parse(
+            "1 1 0:2 / / rw - rootfs rootfs rw\n"
+            "5 1 0:3 / /proc rw - proc proc rw\n");
+
+    ASSERT_EQ(2u, tree.mounts().size());
+    EXPECT_EQ(MountTree::kNoParent, tree.mounts()[0].parent);
+    EXPECT_EQ(std::vector<size_t>{1}, tree.mounts()[0].children);
+    EXPECT_EQ(0u, tree.mounts()[1].parent);
+    EXPECT_EQ((std::vector<std::string>{"/proc", "/"}), postOrderPoints(tree, 0));
+}
+
+TEST_F(MountTreeTest, StackedMountsNewestFirst) {
+    // X on /mnt/a, Y on X at /mnt/a/b, then Z stacked over /mnt/a: Z hides
+    // Y's path, so it has to go first
+    MountTree tree;
+    tree.parse(
+            "1 0 0:2 / / rw - rootfs rootfs rw\n"
+            "10 1 0:10 / /mnt/a rw - tmpfs x rw\n"
+            "11 10 0:11 / /mnt/a/b rw - tmpfs y rw\n"
+            "12 10 0:12 / /mnt/a rw - tmpfs z rw\n"
+            "13 12 0:13 / /mnt/a rw - tmpfs z2 rw\n");
+
+    ASSERT_EQ(5u, tree.mounts().size());
+    std::vector<std::string> sources;
+    for (size_t i : tree.postOrder(1)) sources.push_back(tree.mounts()[i].source);
+    EXPECT_EQ((std::vector<std::string>{"z2", "z", "y", "x"}), sources);
+}
+
+TEST_F(MountTreeTest, RecycledMountIdsFollowLineOrder) {
+    // Mount IDs are reused, so a newer mount can have a lower one
+    MountTree tree;
+    tree.parse(
+            "1 1 0:2 / / rw - rootfs rootfs rw\n"
+            "30 1 0:10 / /mnt/a rw - tmpfs x rw\n"
+            "31 30 0:11 / /mnt/a/b rw - tmpfs y rw\n"
+            "7 30 0:12 / /mnt/a rw - tmpfs z rw\n");
+
+    std::vector<std::string> sources;
+    for (size_t i : tree.postOrder(1)) sources.push_back(tree.mounts()[i].source);
+    EXPECT_EQ((std::vector<std::string>{"z", "y", "x"}), sources);
+}
+
+TEST_F(MountTreeTest, SurvivesParentLoops) {
+    MountTree tree;
+    tree.parse(
+            "2 3 0:2 / /a rw - tmpfs a rw\n"
+            "3 2 0:3 / /b rw - tmpfs b rw\n");
+
+    EXPECT_EQ((std::vector<std::string>{"/b", "/a"}), postOrderPoints(tree, 0));
+}
+
+}  // namespace vold
+}  // namespace android
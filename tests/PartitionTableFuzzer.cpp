@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PartitionTable.h"
+
+// The input is the start of a device; anything past its end reads as zeros,
+// just like a short device. Both common sector sizes are tried, since they
+// put the GPT header and entries at different offsets.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    for (uint32_t sectorSize : {512, 4096}) {
+        android::vold::PartitionTable table;
+        android::vold::ReadPartitionTable(data, size, sectorSize, &table);
+    }
+    return 0;
+}
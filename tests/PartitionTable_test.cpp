@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../PartitionTable.h"
+
+namespace android {
+namespace vold {
+
+static const char* kBasicData = "EBD0A0A2-B9E5-4433-87C0-68B6B72699C7";
+static const char* kAndroidExpand = "193D1EA4-B3CA-11E4-B075-10604B889DCF";
+static const char* kPublicGuid = "0F1E2D3C-4B5A-6978-8796-A5B4C3D2E1F0";
+static const char* kPrivateGuid = "AABBCCDD-EEFF-0011-2233-445566778899";
+
+static uint32_t Crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+    return ~crc;
+}
+
+static void Put16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void Put32(uint8_t* p, uint32_t v) {
+    Put16(p, v);
+    Put16(p + 2, v >> 16);
+}
+
+static void Put64(uint8_t* p, uint64_t v) {
+    Put32(p, v);
+    Put32(p + 4, v >> 32);
+}
+
+// Writes "XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX" in its on-disk mixed endian form
+static void PutGuid(uint8_t* p, const std::string& guid) {
+    auto hex = [&](size_t pos, size_t len) { return std::stoull(guid.substr(pos, len), 0, 16); };
+    Put32(p, hex(0, 8));
+    Put16(p + 4, hex(9, 4));
+    Put16(p + 6, hex(14, 4));
+    p[8] = hex(19, 2);
+    p[9] = hex(21, 2);
+    for (int i = 0; i < 6; i++) p[10 + i] = hex(24 + i * 2, 2);
+}
+
+static void PutMbrEntry(std::vector<uint8_t>* image, int index, uint8_t type, uint32_t start,
+                        uint32_t sectors) {
+    uint8_t* entry = image->data() + 446 + index * 16;
+    entry[4] = type;
+    Put32(entry + 8, start);
+    Put32(entry + 12, sectors);
+    (*image)[510] = 0x55;
+    (*image)[511] = 0xAA;
+}
+
+// What sgdisk writes for Android: a public volume in slot 1 and an adopted
+// one in slot 3, behind a protective MBR
+static std::vector<uint8_t> MakeGpt(uint32_t sectorSize, uint32_t numEntries = 128) {
+    const uint32_t entrySize = 128;
+    std::vector<uint8_t> image(sectorSize * 2 + numEntries * entrySize + sectorSize);
+    PutMbrEntry(&image, 0, 0xee, 1, 0xffffffff);
+
+    uint8_t* entries = image.data() + sectorSize * 2;
+    PutGuid(entries, kBasicData);
+    PutGuid(entries + 16, kPublicGuid);
+    PutGuid(entries + 2 * entrySize, kAndroidExpand);
+    PutGuid(entries + 2 * entrySize + 16, kPrivateGuid);
+
+    uint8_t* header = image.data() + sectorSize;
+    memcpy(header, "EFI PART", 8);
+    Put32(header + 8, 0x10000);
+    Put32(header + 12, 92);
+    Put64(header + 24, 1);
+    Put64(header + 72, 2);
+    Put32(header + 80, numEntries);
+    Put32(header + 84, entrySize);
+    Put32(header + 88, Crc32(entries, numEntries * entrySize));
+    Put32(header + 16, Crc32(header, 92));
+    return image;
+}
+
+static PartitionTable Parse(const std::vector<uint8_t>& image, uint32_t sectorSize) {
+    PartitionTable table;
+    EXPECT_EQ(OK, ReadPartitionTable(image.data(), image.size(), sectorSize, &table));
+    return table;
+}
+
+static PartitionTable ParseSgdisk(const std::vector<std::string>& output) {
+    PartitionTable table;
+    ParseSgdiskOutput(output, &table);
+    return table;
+}
+
+static void ExpectSameTable(const PartitionTable& expected, const PartitionTable& actual) {
+    EXPECT_EQ(expected.type, actual.type);
+    ASSERT_EQ(expected.partitions.size(), actual.partitions.size());
+    for (size_t i = 0; i < expected.partitions.size(); i++) {
+        EXPECT_EQ(expected.partitions[i].number, actual.partitions[i].number);
+        EXPECT_EQ(expected.partitions[i].mbrType, actual.partitions[i].mbrType);
+        EXPECT_EQ(expected.partitions[i].typeGuid, actual.partitions[i].typeGuid);
+        EXPECT_EQ(expected.partitions[i].partGuid, actual.partitions[i].partGuid);
+    }
+}
+
+class PartitionTableTest : public testing::Test {};
+
+TEST_F(PartitionTableTest, GptMatchesSgdisk) {
+    auto sgdisk = ParseSgdisk({
+            "DISK gpt",
+            std::string("PART 1 ") + kBasicData + " " + kPublicGuid + " android_public",
+            std::string("PART 3 ") + kAndroidExpand + " " + kPrivateGuid + " android_expand",
+    });
+    ExpectSameTable(sgdisk, Parse(MakeGpt(512), 512));
+    ExpectSameTable(sgdisk, Parse(MakeGpt(4096), 4096));
+    // Too many entries to fit in the first read
+    ExpectSameTable(sgdisk, Parse(MakeGpt(512, 1024), 512));
+}
+
+TEST_F(PartitionTableTest, MbrMatchesSgdisk) {
+    std::vector<uint8_t> image(512);
+    PutMbrEntry(&image, 0, 0x0c, 2048, 2048);
+    PutMbrEntry(&image, 2, 0x83, 4096, 2048);
+
+    auto sgdisk = ParseSgdisk({"DISK mbr", "PART 1 c", "PART 3 83"});
+    ExpectSameTable(sgdisk, Parse(image, 512));
+}
+
+TEST_F(PartitionTableTest, DamagedGptIsLeftToSgdisk) {
+    auto image = MakeGpt(512);
+    image[512 * 2 + 40] ^= 1;
+    EXPECT_EQ(PartitionTable::Type::kUnknown, Parse(image, 512).type);
+
+    image = MakeGpt(512);
+    image[512 + 56] ^= 1;
+    EXPECT_EQ(PartitionTable::Type::kUnknown, Parse(image, 512).type);
+}
+
+TEST_F(PartitionTableTest, ExtendedMbrIsLeftToSgdisk) {
+    std::vector<uint8_t> image(512);
+    PutMbrEntry(&image, 0, 0x0c, 2048, 2048);
+    PutMbrEntry(&image, 1, 0x0f, 4096, 8192);
+    EXPECT_EQ(PartitionTable::Type::kUnknown, Parse(image, 512).type);
+}
+
+TEST_F(PartitionTableTest, WholeDiskFilesystem) {
+    // A FAT boot sector: the signature is there, but no valid boot indicators
+    std::vector<uint8_t> image(512);
+    memset(image.data() + 446, 0xf6, 64);
+    image[510] = 0x55;
+    image[511] = 0xAA;
+    EXPECT_EQ(PartitionTable::Type::kNone, Parse(image, 512).type);
+
+    EXPECT_EQ(PartitionTable::Type::kNone, Parse(std::vector<uint8_t>(4096), 512).type);
+}
+
+}  // namespace vold
+}  // namespace android
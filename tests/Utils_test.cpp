@@ -16,6 +16,8 @@
 
 #include <android-base/file.h>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../Utils.h"
 
@@ -62,5 +64,23 @@ TEST_F(UtilsTest, MkdirsSyncTest) {
     ASSERT_FALSE(MkdirsSync("foo", 0700));
 }
 
+TEST_F(UtilsTest, TreeBytesHardLinks) {
+    TemporaryDir temp_dir;
+    std::string file = std::string(temp_dir.path) + "/file";
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(100000, 'x'), file));
+    struct stat st;
+    ASSERT_EQ(0, stat(file.c_str(), &st));
+    uint64_t fileBytes = st.st_blocks * 512;
+    if (st.st_blksize) fileBytes = (fileBytes + st.st_blksize - 1) & ~(st.st_blksize - 1);
+
+    uint64_t before = GetTreeBytes(temp_dir.path);
+    ASSERT_EQ(before, GetTreeBytes(temp_dir.path, true));
+    ASSERT_EQ(0, link(file.c_str(), (std::string(temp_dir.path) + "/link").c_str()));
+
+    // Directory sizes don't grow for one more entry on any filesystem we run on
+    EXPECT_EQ(before, GetTreeBytes(temp_dir.path));
+    EXPECT_EQ(before + fileBytes, GetTreeBytes(temp_dir.path, true));
+}
+
 }  // namespace vold
 }  // namespace android